@@ -96,14 +96,18 @@ const vector<string> Defaults = {
 /// are five parameters: TT size in MB, number of search threads that
 /// should be used, the limit value spent for each position, a file name
 /// where to look for positions in FEN format, the type of the limit:
-/// depth, perft, nodes and movetime (in millisecs), and evaluation type
-/// mixed (default), classical, NNUE.
+/// depth, perft, nodes and movetime (in millisecs), evaluation type
+/// mixed (default), classical, NNUE, and as a last parameter "density" to
+/// report the density of the inputs of the NNUE evaluations or "tt" to report
+/// the hit rates of the transposition tables.
 ///
 /// bench -> search default positions up to depth 13
 /// bench 64 1 15 -> search default positions up to depth 15 (TT = 64MB)
 /// bench 64 4 5000 current movetime -> search current position with 4 threads for 5 sec
 /// bench 64 1 100000 default nodes -> search default positions for 100K nodes each
 /// bench 16 1 5 default perft -> run a perft 5 on default positions
+/// bench 16 1 13 default depth mixed density -> also report the NNUE input density
+/// bench 16 1 13 default depth mixed tt -> also report the TT hit rates
 
 vector<string> setup_bench(const Position& current, istream& is) {
 
@@ -117,6 +121,7 @@ vector<string> setup_bench(const Position& current, istream& is) {
   string fenFile   = (is >> token) ? token : "default";
   string limitType = (is >> token) ? token : "depth";
   string evalType  = (is >> token) ? token : "mixed";
+  string stats     = (is >> token) ? token : "";
 
   go = limitType == "eval" ? "eval" : "go " + limitType + " " + limit;
 
@@ -144,6 +149,10 @@ vector<string> setup_bench(const Position& current, istream& is) {
       file.close();
   }
 
+  // Not a UCI command, it is handled by bench()
+  if (stats == "density" || stats == "tt")
+      list.emplace_back(stats);
+
   list.emplace_back("setoption name Threads value " + threads);
   list.emplace_back("setoption name Hash value " + ttSize);
   list.emplace_back("ucinewgame");
@@ -327,7 +327,18 @@ inline Bitboard attacks_bb(PieceType pt, Square s, Bitboard occupied) {
 
 inline int popcount(Bitboard b) {
 
-#ifndef USE_POPCNT
+#if defined(USE_DISPATCH) && !defined(USE_POPCNT)
+
+  if (HasPopCnt)
+  {
+      __asm__("popcntq %1, %0" : "=r" (b) : "rm" (b));
+      return int(b);
+  }
+
+  union { Bitboard bb; uint16_t u[4]; } v = { b };
+  return PopCnt16[v.u[0]] + PopCnt16[v.u[1]] + PopCnt16[v.u[2]] + PopCnt16[v.u[3]];
+
+#elif !defined(USE_POPCNT)
 
   union { Bitboard bb; uint16_t u[4]; } v = { b };
   return PopCnt16[v.u[0]] + PopCnt16[v.u[1]] + PopCnt16[v.u[2]] + PopCnt16[v.u[3]];
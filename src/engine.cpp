@@ -0,0 +1,186 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sstream>
+
+#include "bitboard.h"
+#include "endgame.h"
+#include "engine.h"
+#include "evaluate.h"
+#include "psqt.h"
+
+
+std::mutex Engine::evalMutex;
+int Engine::instances = 0;
+
+
+/// Engine::init() initializes the tables shared by all the instances, and loads
+/// the default network.
+
+void Engine::init() {
+
+  PSQT::init();
+  Bitboards::init();
+  Position::init();
+  Bitbases::init();
+  Endgames::init();
+  Eval::NNUE::init(true, EvalFileDefaultName);
+}
+
+
+/// Engine constructor sets the options to their default values, but for the
+/// ones of the network which are set to the values in effect in the process,
+/// then creates the threads and the transposition table.
+
+Engine::Engine() : states(new std::deque<StateInfo>(1)) {
+
+  {
+      std::lock_guard<std::mutex> lk(evalMutex);
+      ++instances;
+  }
+
+  UCI::init(options, *this);
+  sync_eval_options();
+  threads.set(shared(), size_t(options["Threads"]));
+  search_clear(); // After threads are up
+
+  pos.set(StartFEN, false, &states->back(), threads.main());
+}
+
+
+/// Engine destructor stops any running search and destroys the threads
+
+Engine::~Engine() {
+
+  stop();
+  threads.set(shared(), 0);
+
+  std::lock_guard<std::mutex> lk(evalMutex);
+  --instances;
+}
+
+
+/// Engine::set_position() sets up the position described in the given FEN
+/// string, then makes the moves given in coordinate notation, up to the first
+/// illegal one.
+
+void Engine::set_position(const std::string& fen, const std::vector<std::string>& moves) {
+
+  states = StateListPtr(new std::deque<StateInfo>(1)); // Drop old and create a new one
+  pos.set(fen, options["UCI_Chess960"], &states->back(), threads.main());
+
+  for (std::string token : moves)
+  {
+      Move m = UCI::to_move(pos, token);
+      if (m == MOVE_NONE)
+          break;
+
+      states->emplace_back();
+      pos.do_move(m, states->back());
+  }
+}
+
+
+/// Engine::go() starts a search of the current position and returns immediately.
+/// The results are reported through the callbacks of 'updates'.
+
+void Engine::go(const Search::LimitsType& limits, bool ponderMode) {
+
+  threads.start_thinking(options, pos, states, limits, ponderMode);
+}
+
+
+/// Engine::search_clear() resets the search state to its initial value,
+/// usually before a new game. The threads clear their tables in the
+/// background: the next search, or wait_for_clear(), waits for them.
+
+void Engine::search_clear() {
+
+  wait_for_search_finished();
+
+  tt.clear(threads.size());
+  threads.clear();
+}
+
+
+/// Engine::resize_threads() sets the number of threads to the "Threads" option,
+/// and Engine::resize_tt() the size of the hash to the "Hash" option.
+
+void Engine::resize_threads() {
+
+  threads.set(shared(), size_t(options["Threads"]));
+
+  if (!threads.cpus.empty())
+  {
+      std::stringstream ss;
+      ss << "Threads bound to CPUs";
+
+      for (size_t i = 0; i < threads.size(); ++i)
+          ss << " " << threads.cpus[i % threads.cpus.size()];
+
+      updates.onInfoString(ss.str());
+  }
+}
+
+/// Engine::set_eval() is called when the "Use NNUE" or "EvalFile" option is
+/// changed. The network is shared by all the instances of the process, so it
+/// is only reloaded when this instance is the only one, after its search. With
+/// several instances the change is refused, and the options are set back.
+
+void Engine::set_eval() {
+
+  bool use = options["Use NNUE"];
+  std::string evalFile = std::string(options["EvalFile"]);
+
+  {
+      std::lock_guard<std::mutex> lk(evalMutex);
+
+      if (use == Eval::useNNUE && (!use || evalFile == Eval::eval_file_loaded))
+          return;
+
+      if (instances == 1)
+      {
+          wait_for_search_finished();
+          Eval::NNUE::init(use, evalFile);
+          return;
+      }
+  }
+
+  updates.onInfoString("The network is shared by all the engine instances, and cannot be changed while there are several");
+  sync_eval_options();
+}
+
+
+/// Engine::sync_eval_options() sets the options of the network to the values in
+/// effect in the process. As these are then unchanged, set_eval() does nothing.
+
+void Engine::sync_eval_options() {
+
+  options["Use NNUE"] = std::string(Eval::useNNUE ? "true" : "false");
+
+  if (Eval::eval_file_loaded != "None")
+      options["EvalFile"] = Eval::eval_file_loaded;
+}
+
+void Engine::resize_tt() {
+
+  wait_for_search_finished();
+
+  tt.resize(size_t(options["Hash"]), threads.size(), options["NUMA Hash"], options["Rehash"]);
+  updates.onInfoString(tt.clear_info());
+}
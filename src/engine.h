@@ -0,0 +1,76 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ENGINE_H_INCLUDED
+#define ENGINE_H_INCLUDED
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "position.h"
+#include "search.h"
+#include "thread.h"
+#include "tt.h"
+#include "uci.h"
+
+/// Engine class is an instance of the engine, which can be embedded in another
+/// program. Each instance owns its options, transposition table and thread pool,
+/// and reports its searches through the callbacks of 'updates'. All instances
+/// of a process share the read-only tables, the tablebases and the NNUE network:
+/// Engine::init() must be called once before creating the first instance. The
+/// network can only be changed while a single instance exists.
+
+class Engine {
+
+public:
+  static constexpr const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+  Engine();
+ ~Engine();
+
+  static void init();
+
+  void set_position(const std::string& fen, const std::vector<std::string>& moves);
+  void go(const Search::LimitsType& limits, bool ponderMode = false);
+  void stop() { threads.stop = true; }
+  void ponderhit() { threads.main()->ponder = false; }
+  void wait_for_search_finished() { threads.main()->wait_for_search_finished(); }
+  void wait_for_clear() { threads.wait_for_clear(); }
+  void search_clear();
+  void resize_threads();
+  void resize_tt();
+  void set_eval();
+
+  UCI::OptionsMap options;
+  TranspositionTable tt;
+  ThreadPool threads;
+  Search::UpdateContext updates;
+  Position pos;
+
+private:
+  Search::SharedState shared() { return { options, threads, tt, updates }; }
+  void sync_eval_options();
+
+  static std::mutex evalMutex; // Guards the network and the count of instances
+  static int instances;
+
+  StateListPtr states;
+};
+
+#endif // #ifndef ENGINE_H_INCLUDED
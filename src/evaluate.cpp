@@ -63,20 +63,22 @@ namespace Eval {
 
   /// NNUE::init() tries to load a NNUE network at startup time, or when the engine
   /// receives a UCI command "setoption name EvalFile value nn-[a-z0-9]{12}.nnue"
-  /// The name of the NNUE network is always retrieved from the EvalFile option.
+  /// The name of the NNUE network is given by the EvalFile option.
   /// We search the given network in three locations: internally (the default
   /// network may be embedded in the binary), in the active working directory and
   /// in the engine directory. Distro packagers may define the DEFAULT_NNUE_DIRECTORY
   /// variable to have the engine search in a special directory in their distro.
+  /// The file may also be an image of the network written by the "savenet"
+  /// command, which is mapped in memory and shared with the other processes.
+  /// The network is shared by all the engine instances of the process, and must
+  /// not be changed while any of them is searching: see Engine::set_eval().
 
-  void NNUE::init() {
+  void NNUE::init(bool use, const string& eval_file) {
 
-    useNNUE = Options["Use NNUE"];
+    useNNUE = use;
     if (!useNNUE)
         return;
 
-    string eval_file = string(Options["EvalFile"]);
-
     #if defined(DEFAULT_NNUE_DIRECTORY)
     #define stringify2(x) #x
     #define stringify(x) stringify2(x)
@@ -90,9 +92,15 @@ namespace Eval {
         {
             if (directory != "<internal>")
             {
-                ifstream stream(directory + eval_file, ios::binary);
-                if (load_eval(eval_file, stream))
+                // Map the file if it is an image, else read it as a network
+                if (map_image(eval_file, directory + eval_file))
                     eval_file_loaded = eval_file;
+                else
+                {
+                    ifstream stream(directory + eval_file, ios::binary);
+                    if (load_eval(eval_file, stream))
+                        eval_file_loaded = eval_file;
+                }
             }
 
             if (directory == "<internal>" && eval_file == EvalFileDefaultName)
@@ -112,35 +120,36 @@ namespace Eval {
         }
   }
 
-  /// NNUE::verify() verifies that the last net used was loaded successfully
-  void NNUE::verify() {
+  /// NNUE::verify() verifies that the last net used was loaded successfully,
+  /// sending its messages to the given callback.
+  void NNUE::verify(UCI::OptionsMap& options, const std::function<void(const string&)>& onInfo) {
 
-    string eval_file = string(Options["EvalFile"]);
+    string eval_file = string(options["EvalFile"]);
 
     if (useNNUE && eval_file_loaded != eval_file)
     {
-        UCI::OptionsMap defaults;
-        UCI::init(defaults);
-
         string msg1 = "If the UCI option \"Use NNUE\" is set to true, network evaluation parameters compatible with the engine must be available.";
         string msg2 = "The option is set to true, but the network file " + eval_file + " was not loaded successfully.";
         string msg3 = "The UCI option EvalFile might need to specify the full path, including the directory name, to the network file.";
-        string msg4 = "The default net can be downloaded from: https://tests.stockfishchess.org/api/nn/" + string(defaults["EvalFile"]);
+        string msg4 = "The default net can be downloaded from: https://tests.stockfishchess.org/api/nn/" EvalFileDefaultName;
         string msg5 = "The engine will be terminated now.";
 
-        sync_cout << "info string ERROR: " << msg1 << sync_endl;
-        sync_cout << "info string ERROR: " << msg2 << sync_endl;
-        sync_cout << "info string ERROR: " << msg3 << sync_endl;
-        sync_cout << "info string ERROR: " << msg4 << sync_endl;
-        sync_cout << "info string ERROR: " << msg5 << sync_endl;
+        onInfo("ERROR: " + msg1);
+        onInfo("ERROR: " + msg2);
+        onInfo("ERROR: " + msg3);
+        onInfo("ERROR: " + msg4);
+#if defined(NNUE_FT_INT8)
+        onInfo("ERROR: This build stores the feature transformer weights in 8 bits and only accepts nets whose weights all fit.");
+#endif
+        onInfo("ERROR: " + msg5);
 
         exit(EXIT_FAILURE);
     }
 
     if (useNNUE)
-        sync_cout << "info string NNUE evaluation using " << eval_file << " enabled" << sync_endl;
+        onInfo("NNUE evaluation using " + eval_file + " enabled");
     else
-        sync_cout << "info string classical evaluation enabled" << sync_endl;
+        onInfo("classical evaluation enabled");
   }
 }
 
@@ -19,9 +19,11 @@
 #ifndef EVALUATE_H_INCLUDED
 #define EVALUATE_H_INCLUDED
 
+#include <functional>
 #include <string>
 
 #include "types.h"
+#include "uci.h"
 
 class Position;
 
@@ -41,9 +43,13 @@ namespace Eval {
   namespace NNUE {
 
     Value evaluate(const Position& pos);
+    void evaluate(const Position* const* positions, std::size_t count, Value* values);
+    std::string benchmark(Position& pos, int iterations);
     bool load_eval(std::string name, std::istream& stream);
-    void init();
-    void verify();
+    bool map_image(std::string name, const std::string& path);
+    bool save_image(const std::string& path);
+    void init(bool use, const std::string& evalFile);
+    void verify(UCI::OptionsMap& options, const std::function<void(const std::string&)>& onInfo);
 
   } // namespace NNUE
 
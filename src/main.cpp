@@ -18,14 +18,7 @@
 
 #include <iostream>
 
-#include "bitboard.h"
-#include "endgame.h"
-#include "position.h"
-#include "psqt.h"
-#include "search.h"
-#include "syzygy/tbprobe.h"
-#include "thread.h"
-#include "tt.h"
+#include "engine.h"
 #include "uci.h"
 
 int main(int argc, char* argv[]) {
@@ -33,19 +26,12 @@ int main(int argc, char* argv[]) {
   std::cout << engine_info() << std::endl;
 
   CommandLine::init(argc, argv);
-  UCI::init(Options);
-  Tune::init();
-  PSQT::init();
-  Bitboards::init();
-  Position::init();
-  Bitbases::init();
-  Endgames::init();
-  Threads.set(size_t(Options["Threads"]));
-  Search::clear(); // After threads are up
-  Eval::NNUE::init();
-
-  UCI::loop(argc, argv);
-
-  Threads.set(0);
+  Engine::init();
+
+  Engine engine;
+  Tune::init(engine.options);
+
+  UCI::loop(engine, argc, argv);
+
   return 0;
 }
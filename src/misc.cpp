@@ -39,6 +39,7 @@ typedef bool(*fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 }
 #endif
 
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -46,9 +47,23 @@ typedef bool(*fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 #include <vector>
 #include <cstdlib>
 
+#if defined(USE_DISPATCH)
+#include <cpuid.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #if defined(__linux__) && !defined(__ANDROID__)
+#include <sched.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #endif
 
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) || (defined(__GLIBCXX__) && !defined(_GLIBCXX_HAVE_ALIGNED_ALLOC) && !defined(_WIN32))
@@ -240,6 +255,11 @@ const std::string compiler_info() {
     compiler += " SSE2";
   #endif
   compiler += (HasPopCnt ? " POPCNT" : "");
+  #if defined(USE_DISPATCH)
+    compiler += " DISPATCH(";
+    compiler += CPU::target_name(CPU::best_target());
+    compiler += ")";
+  #endif
   #if defined(USE_MMX)
     compiler += " MMX";
   #endif
@@ -464,35 +484,93 @@ void aligned_large_pages_free(void *mem) {
 #endif
 
 
-namespace WinProcGroup {
+/// map_file() maps a whole file read-only in memory and returns its address,
+/// or nullptr on failure. The pages are shared with all the processes that map
+/// the same file. The mapping must be released with unmap_file().
+
+#if defined(_WIN32)
+
+void* map_file(const std::string& fname, size_t* size) {
+
+  HANDLE file = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+      return nullptr;
+
+  LARGE_INTEGER fileSize;
+  HANDLE mapping = GetFileSizeEx(file, &fileSize) && fileSize.QuadPart
+                 ? CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+  CloseHandle(file);
+  if (!mapping)
+      return nullptr;
+
+  void* mem = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping); // The view keeps the mapping alive
+  *size = size_t(fileSize.QuadPart);
+  return mem;
+}
 
-#ifndef _WIN32
+void unmap_file(void* mem, size_t) {
+  if (mem)
+      UnmapViewOfFile(mem);
+}
+
+#elif defined(__unix__) || defined(__APPLE__)
 
-void bindThisThread(size_t) {}
+void* map_file(const std::string& fname, size_t* size) {
+
+  int fd = ::open(fname.c_str(), O_RDONLY);
+  if (fd == -1)
+      return nullptr;
+
+  struct stat statbuf;
+  void* mem = fstat(fd, &statbuf) == 0 && statbuf.st_size > 0
+            ? mmap(nullptr, size_t(statbuf.st_size), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  ::close(fd); // The mapping keeps the file open
+  if (mem == MAP_FAILED)
+      return nullptr;
+
+  *size = size_t(statbuf.st_size);
+  return mem;
+}
+
+void unmap_file(void* mem, size_t size) {
+  if (mem)
+      munmap(mem, size);
+}
 
 #else
 
-/// best_group() retrieves logical processor information using Windows specific
-/// API and returns the best group id for the thread with index idx. Original
-/// code from Texel by Peter Österlund.
+void* map_file(const std::string&, size_t*) { return nullptr; }
+void unmap_file(void*, size_t) {}
 
-int best_group(size_t idx) {
+#endif
+
+
+namespace WinProcGroup {
+
+#if defined(_WIN32)
+
+/// get_topology() retrieves logical processor information using Windows
+/// specific API and counts the NUMA nodes, the cores and the logical processors
+/// of the machine. Returns false if the needed API is not available.
+
+static bool get_topology(int& nodes, int& cores, int& threads) {
 
-  int threads = 0;
-  int nodes = 0;
-  int cores = 0;
   DWORD returnLength = 0;
   DWORD byteOffset = 0;
 
+  nodes = cores = threads = 0;
+
   // Early exit if the needed API is not available at runtime
   HMODULE k32 = GetModuleHandle("Kernel32.dll");
   auto fun1 = (fun1_t)(void(*)())GetProcAddress(k32, "GetLogicalProcessorInformationEx");
   if (!fun1)
-      return -1;
+      return false;
 
   // First call to get returnLength. We expect it to fail due to null buffer
   if (fun1(RelationAll, nullptr, &returnLength))
-      return -1;
+      return false;
 
   // Once we know returnLength, allocate the buffer
   SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *buffer, *ptr;
@@ -502,7 +580,7 @@ int best_group(size_t idx) {
   if (!fun1(RelationAll, buffer, &returnLength))
   {
       free(buffer);
-      return -1;
+      return false;
   }
 
   while (byteOffset < returnLength)
@@ -523,6 +601,20 @@ int best_group(size_t idx) {
 
   free(buffer);
 
+  return nodes > 0;
+}
+
+
+/// best_group() returns the best group id for the thread with index idx.
+/// Original code from Texel by Peter Österlund.
+
+int best_group(size_t idx) {
+
+  int threads, nodes, cores;
+
+  if (!get_topology(nodes, cores, threads))
+      return -1;
+
   std::vector<int> groups;
 
   // Run as many threads as possible on the same node until core limit is
@@ -543,15 +635,19 @@ int best_group(size_t idx) {
 }
 
 
-/// bindThisThread() set the group affinity of the current thread
+/// groups_count() returns the number of NUMA nodes of the machine
 
-void bindThisThread(size_t idx) {
+int groups_count() {
 
-  // Use only local variables to be thread-safe
-  int group = best_group(idx);
+  int threads, nodes, cores;
 
-  if (group == -1)
-      return;
+  return get_topology(nodes, cores, threads) ? nodes : 1;
+}
+
+
+/// bindThisThreadToGroup() sets the group affinity of the current thread
+
+void bindThisThreadToGroup(int group) {
 
   // Early exit if the needed API are not available at runtime
   HMODULE k32 = GetModuleHandle("Kernel32.dll");
@@ -566,10 +662,414 @@ void bindThisThread(size_t idx) {
       fun3(GetCurrentThread(), &affinity, nullptr);
 }
 
+
+/// bindMemoryToGroup() is a nop under Windows: pages are placed on the node of
+/// the thread that touches them first.
+
+void bindMemoryToGroup(void*, size_t, int) {}
+
+
+/// Threads are not bound to single logical processors under Windows, where
+/// binding them to groups is enough.
+
+static bool cpu_allowed(int) { return true; }
+int cpu_group(int) { return -1; }
+void bindThisThreadToCpu(int) {}
+
+#elif defined(__linux__) && !defined(__ANDROID__)
+
+/// A NUMA node as exported by the kernel: its id and its logical processors
+
+struct NumaNode {
+  int id;
+  vector<int> cpus;
+};
+
+/// numa_nodes() reads the NUMA topology from sysfs. Nodes without processors,
+/// like memory only nodes, are skipped. The topology is read only once.
+
+static const vector<NumaNode>& numa_nodes() {
+
+  static const vector<NumaNode> nodes = [] {
+
+      vector<NumaNode> v;
+
+      for (int id = 0; id < 1024; ++id)
+      {
+          ifstream file("/sys/devices/system/node/node" + to_string(id) + "/cpulist");
+          string list;
+
+          if (file.is_open() && getline(file, list))
+          {
+              vector<int> cpus = parse_cpu_list(list);
+              if (!cpus.empty())
+                  v.push_back({ id, cpus });
+          }
+      }
+
+      return v;
+  }();
+
+  return nodes;
+}
+
+
+/// A logical processor of the machine: its id, the index of its NUMA node in
+/// numa_nodes() and its rank among the SMT siblings of its physical core.
+
+struct LogicalCpu {
+  int id, node, smtRank;
+};
+
+/// allowed_cpus() returns the logical processors the process may run on, as
+/// restricted by taskset or a cpuset. It is the affinity of the main thread,
+/// which is never bound, read only once.
+
+static const cpu_set_t& allowed_cpus() {
+
+  static const cpu_set_t mask = [] {
+
+      cpu_set_t m;
+
+      if (sched_getaffinity(getpid(), sizeof(cpu_set_t), &m))
+      {
+          CPU_ZERO(&m);
+          for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+              CPU_SET(cpu, &m);
+      }
+
+      return m;
+  }();
+
+  return mask;
+}
+
+/// cpu_allowed() checks whether the process may run on a logical processor
+
+static bool cpu_allowed(int cpu) {
+
+  return cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed_cpus());
+}
+
+/// read_int() reads the first integer of a sysfs file, or returns -1
+
+static int read_int(const string& path) {
+
+  ifstream file(path);
+  int v = -1;
+
+  return file >> v ? v : -1;
+}
+
+/// placement() reads the topology of the online logical processors the process
+/// may run on from sysfs, and sorts them in the order threads are placed on
+/// them: the first logical processor of each physical core before the SMT
+/// siblings and, in each of these rounds, one node after the other. It is read
+/// only once.
+
+static const vector<LogicalCpu>& placement() {
+
+  static const vector<LogicalCpu> cpus = [] {
+
+      vector<LogicalCpu> v;
+      vector<pair<int, int>> cores; // (package, core) of each cpu in v
+      const vector<NumaNode>& nodes = numa_nodes();
+
+      ifstream file("/sys/devices/system/cpu/online");
+      string list;
+
+      if (!file.is_open() || !getline(file, list))
+          return v;
+
+      for (int id : parse_cpu_list(list))
+      {
+          if (!cpu_allowed(id))
+              continue;
+
+          string topology = "/sys/devices/system/cpu/cpu" + to_string(id) + "/topology/";
+          pair<int, int> core = { read_int(topology + "physical_package_id"),
+                                  read_int(topology + "core_id") };
+          int node = 0;
+
+          for (size_t n = 0; n < nodes.size(); ++n)
+              if (std::count(nodes[n].cpus.begin(), nodes[n].cpus.end(), id))
+                  node = int(n);
+
+          // Without core_id, as in some virtual machines, assume no SMT
+          int smtRank = core.second < 0 ? 0 : int(std::count(cores.begin(), cores.end(), core));
+
+          v.push_back({ id, node, smtRank });
+          cores.push_back(core);
+      }
+
+      std::stable_sort(v.begin(), v.end(), [](const LogicalCpu& a, const LogicalCpu& b) {
+          return a.smtRank != b.smtRank ? a.smtRank < b.smtRank : a.node < b.node;
+      });
+
+      return v;
+  }();
+
+  return cpus;
+}
+
+
+/// best_group() returns the best group id for the thread with index idx, the
+/// node of the logical processor it is placed on. A single node machine
+/// returns -1, there is nothing to bind.
+
+int best_group(size_t idx) {
+
+  const vector<LogicalCpu>& cpus = placement();
+
+  if (numa_nodes().size() < 2)
+      return -1;
+
+  // More threads than logical processors, let the OS decide
+  return idx < cpus.size() ? cpus[idx].node : -1;
+}
+
+
+/// cpu_group() returns the group id of the node of a logical processor. As for
+/// best_group(), a single node machine returns -1.
+
+int cpu_group(int cpu) {
+
+  const vector<NumaNode>& nodes = numa_nodes();
+
+  if (nodes.size() < 2)
+      return -1;
+
+  for (size_t n = 0; n < nodes.size(); ++n)
+      if (std::count(nodes[n].cpus.begin(), nodes[n].cpus.end(), cpu))
+          return int(n);
+
+  return -1;
+}
+
+
+/// groups_count() returns the number of NUMA nodes of the machine
+
+int groups_count() {
+
+  return std::max(int(numa_nodes().size()), 1);
+}
+
+
+/// bindThisThreadToGroup() restricts the current thread to the logical
+/// processors of the given node that the process may run on.
+
+void bindThisThreadToGroup(int group) {
+
+  const vector<NumaNode>& nodes = numa_nodes();
+
+  if (group < 0 || group >= int(nodes.size()))
+      return;
+
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+
+  for (int cpu : nodes[group].cpus)
+      if (cpu_allowed(cpu))
+          CPU_SET(cpu, &mask);
+
+  if (CPU_COUNT(&mask) == 0)
+      return;
+
+  sched_setaffinity(0, sizeof(cpu_set_t), &mask);
+}
+
+
+/// bindThisThreadToCpu() restricts the current thread to a logical processor
+
+void bindThisThreadToCpu(int cpu) {
+
+  if (!cpu_allowed(cpu))
+      return;
+
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(cpu, &mask);
+
+  sched_setaffinity(0, sizeof(cpu_set_t), &mask);
+}
+
+
+/// bindMemoryToGroup() sets the preferred node of a page aligned memory range,
+/// so that its pages are allocated on that node when first touched. We call
+/// the system call directly to avoid a dependency on libnuma.
+
+void bindMemoryToGroup(void* mem, size_t size, int group) {
+
+#if defined(SYS_mbind)
+  const vector<NumaNode>& nodes = numa_nodes();
+
+  if (!mem || !size || group < 0 || group >= int(nodes.size()))
+      return;
+
+  constexpr int MPOL_PREFERRED_MODE = 1; // MPOL_PREFERRED from linux/mempolicy.h
+  constexpr size_t BitsPerWord = 8 * sizeof(unsigned long);
+  unsigned long mask[1024 / BitsPerWord] = {};
+
+  int id = nodes[group].id;
+  mask[id / BitsPerWord] |= 1UL << (id % BitsPerWord);
+
+  syscall(SYS_mbind, mem, size, MPOL_PREFERRED_MODE, mask, 1024 + 1, 0);
+#else
+  (void)mem, (void)size, (void)group;
+#endif
+}
+
+#else
+
+static bool cpu_allowed(int) { return true; }
+int best_group(size_t) { return -1; }
+int cpu_group(int) { return -1; }
+int groups_count() { return 1; }
+void bindThisThreadToGroup(int) {}
+void bindThisThreadToCpu(int) {}
+void bindMemoryToGroup(void*, size_t, int) {}
+
 #endif
 
+
+/// parse_cpu_list() converts a cpu list in the format of sysfs, like "0-7,16-23",
+/// into the list of the corresponding logical processors. Negative or reversed
+/// ranges are skipped, and ranges are cut at MaxCpus (CPU_SETSIZE of glibc).
+
+vector<int> parse_cpu_list(const string& list) {
+
+  constexpr int MaxCpus = 1024;
+
+  vector<int> cpus;
+  stringstream ss(list);
+  string range;
+
+  while (getline(ss, range, ','))
+  {
+      if (range.find_first_of("0123456789") == string::npos)
+          continue;
+
+      size_t dash = range.find('-');
+      long first = strtol(range.c_str(), nullptr, 10);
+      long last  = dash == string::npos ? first : strtol(range.c_str() + dash + 1, nullptr, 10);
+
+      if (first < 0 || last < first)
+          continue;
+
+      for (long c = first; c <= std::min(last, long(MaxCpus - 1)); ++c)
+          cpus.push_back(int(c));
+  }
+
+  return cpus;
+}
+
+
+/// thread_cpus() returns the logical processors of a cpu list that the process
+/// may run on, to bind the threads to in turn. Threads are only bound to single
+/// logical processors on request: an empty result leaves them to the node
+/// binding of bindThisThread(), see idle_loop().
+
+vector<int> thread_cpus(const string& list) {
+
+  vector<int> cpus = parse_cpu_list(list);
+
+  cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [](int cpu) { return !cpu_allowed(cpu); }),
+             cpus.end());
+
+  return cpus;
+}
+
+
+/// bindThisThread() sets the group affinity of the current thread
+
+void bindThisThread(size_t idx) {
+
+  // Use only local variables to be thread-safe
+  int group = best_group(idx);
+
+  if (group == -1)
+      return;
+
+  bindThisThreadToGroup(group);
+}
+
 } // namespace WinProcGroup
 
+#if defined(USE_DISPATCH)
+
+namespace CPU {
+
+namespace {
+
+  struct Features {
+    bool popcnt, sse41, avx2, fastPext, avxvnni, avx512, vnni512;
+  };
+
+  // Query the CPU once. Note that __builtin_cpu_supports() also checks that the
+  // OS saves the AVX and AVX512 registers, which the instruction sets need.
+  Features detect() {
+
+    Features f;
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+    __builtin_cpu_init();
+    f.popcnt  = __builtin_cpu_supports("popcnt");
+    f.sse41   = __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+    f.avx2    = f.sse41 && __builtin_cpu_supports("avx2");
+    f.avx512  = f.avx2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    f.vnni512 =  f.avx512 && __builtin_cpu_supports("avx512vnni")
+              && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512dq");
+
+    // AVX-VNNI is reported in EAX of leaf 7, subleaf 1
+    f.avxvnni = f.avx2 && __get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx) && (eax & (1 << 4));
+
+    // On AMD CPUs before Zen 3 (family 19h), pext is microcoded with a latency
+    // of up to hundreds of cycles and magic bitboards are much faster.
+    __get_cpuid(0, &eax, &ebx, &ecx, &edx);
+    bool amd = ebx == 0x68747541 || ebx == 0x6f677948; // "AuthenticAMD" or "HygonGenuine"
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    unsigned family = (eax >> 8) & 0xF;
+    if (family == 0xF)
+        family += (eax >> 20) & 0xFF;
+
+    f.fastPext = Is64Bit && __builtin_cpu_supports("bmi2") && !(amd && family < 0x19);
+
+    return f;
+  }
+
+  const Features& features() {
+    static const Features f = detect();
+    return f;
+  }
+
+} // namespace
+
+Target best_target() {
+
+  const Features& f = features();
+
+  return f.vnni512 ? VNNI512
+       : f.avx512  ? AVX512
+       : f.avxvnni ? AVXVNNI
+       : f.avx2    ? AVX2
+       : f.sse41   ? SSE41
+                   : SSE2;
+}
+
+bool has_popcnt()    { return features().popcnt; }
+bool has_fast_pext() { return features().fastPext; }
+
+const char* target_name(Target t) {
+  constexpr const char* names[] = { "SSE2", "SSE41", "AVX2", "AVXVNNI", "AVX512", "VNNI512" };
+  return names[t];
+}
+
+} // namespace CPU
+
+bool HasPopCnt = CPU::has_popcnt();
+bool HasPext   = CPU::has_fast_pext();
+#endif
+
 #ifdef _WIN32
 #include <direct.h>
 #define GETCWD _getcwd
@@ -36,6 +36,8 @@ void* std_aligned_alloc(size_t alignment, size_t size);
 void std_aligned_free(void* ptr);
 void* aligned_large_pages_alloc(size_t size); // memory aligned by page size, min alignment: 4096 bytes
 void aligned_large_pages_free(void* mem); // nop if mem == nullptr
+void* map_file(const std::string& fname, size_t* size); // read-only, shared between processes
+void unmap_file(void* mem, size_t size); // nop if mem == nullptr
 
 void dbg_hit_on(bool b);
 void dbg_hit_on(bool c, bool b);
@@ -130,12 +132,39 @@ inline uint64_t mul_hi64(uint64_t a, uint64_t b) {
 /// logical processor group. This usually means to be limited to use max 64
 /// cores. To overcome this, some special platform specific API should be
 /// called to set group affinity for each thread. Original code from Texel by
-/// Peter Österlund.
+/// Peter Österlund. Under Linux the groups are the NUMA nodes exported by the
+/// kernel in sysfs, so that threads and memory can be kept on the same node,
+/// and threads can also be bound to single logical processors, one per
+/// physical core first and then on the SMT siblings.
 
 namespace WinProcGroup {
   void bindThisThread(size_t idx);
+  void bindThisThreadToGroup(int group);
+  void bindThisThreadToCpu(int cpu);
+  void bindMemoryToGroup(void* mem, size_t size, int group);
+  int best_group(size_t idx);
+  int cpu_group(int cpu);
+  int groups_count();
+  std::vector<int> parse_cpu_list(const std::string& list);
+  std::vector<int> thread_cpus(const std::string& list);
 }
 
+/// In a dispatch build (ARCH=x86-64-dispatch) the whole engine is compiled for
+/// plain x86-64, and the NNUE code is compiled once more for each of the
+/// instruction sets below. The best one supported by the CPU is picked at
+/// startup, and so are the popcnt and pext instructions.
+
+#if defined(USE_DISPATCH)
+namespace CPU {
+  enum Target { SSE2, SSE41, AVX2, AVXVNNI, AVX512, VNNI512 };
+
+  Target best_target();
+  const char* target_name(Target t);
+  bool has_popcnt();
+  bool has_fast_pext();
+}
+#endif
+
 namespace CommandLine {
   void init(int argc, char* argv[]);
 
@@ -27,6 +27,7 @@
 #include "../layers/input_slice.h"
 #include "../layers/affine_transform.h"
 #include "../layers/clipped_relu.h"
+#include "../layers/fused_output.h"
 
 namespace Eval::NNUE {
 
@@ -18,12 +18,27 @@
 
 // Code for calculating NNUE evaluation function
 
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <set>
+#include <sstream>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
 
 #include "../evaluate.h"
+#include "../movegen.h"
 #include "../position.h"
 #include "../misc.h"
+#include "../thread.h"
 #include "../uci.h"
 #include "../types.h"
 
@@ -31,15 +46,68 @@
 
 namespace Eval::NNUE {
 
-  // Input feature converter
-  LargePagePtr<FeatureTransformer> feature_transformer;
+#if !defined(USE_DISPATCH) || defined(NNUE_TARGET)
+
+  NNUE_TARGET_BEGIN
+
+  // Parameters read from a network file
+  LargePagePtr<FeatureTransformer> featureTransformerStorage;
+  AlignedPtr<Network> networkStorage;
+
+  // Image file mapped in memory, see map_image()
+  void* image;
+  std::size_t imageSize;
 
-  // Evaluation function
-  AlignedPtr<Network> network;
+  // Input feature converter and evaluation function in use, either read from
+  // a network file or mapped from an image file
+  const FeatureTransformer* feature_transformer;
+  const Network* network;
 
   // Evaluation function file name
   std::string fileName;
 
+  // Number of networks loaded so far, used to invalidate the accumulator caches
+  std::uint32_t netEpoch;
+
+  // An image file holds the parameters as they are laid out in memory, already
+  // converted and permuted for the instruction set, so that they can be used
+  // directly from a read-only mapping of the file, shared by all the engine
+  // processes of the machine. The parameters start at page boundaries.
+  struct ImageHeader {
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t hashValue;
+    std::uint32_t layout;
+    std::uint32_t padding;
+    std::uint64_t featureTransformerSize;
+    std::uint64_t networkSize;
+    std::uint64_t checksum;
+  };
+
+  constexpr char          kImageMagic[8] = "SF-NNUE";
+  constexpr std::uint32_t kImageVersion  = 2;
+
+  constexpr std::size_t kImageFeatureTransformerOffset = 4096;
+  constexpr std::size_t kImageNetworkOffset =
+      kImageFeatureTransformerOffset + CeilToMultiple<std::size_t>(sizeof(FeatureTransformer), 4096);
+
+  // The layout of the parameters depends on the weight order used with SSSE3,
+  // on whether the weights that could saturate 16-bit sums are split out,
+  // which is not needed with VNNI, and on the size of the weights of the
+  // feature transformer. Images are not portable across endianness, but then
+  // the hash value does not match either.
+  constexpr std::uint32_t kImageLayout =
+#if defined(USE_SSSE3)
+      1 +
+#endif
+#if defined(USE_VNNI)
+      2 +
+#endif
+#if defined(NNUE_FT_INT8)
+      4 +
+#endif
+      0;
+
   namespace Detail {
 
   // Initialize the evaluation function parameters
@@ -68,13 +136,70 @@ namespace Eval::NNUE {
     return reference.ReadParameters(stream);
   }
 
+  // Checksum of the parameters of an image, whose sizes are multiples of 8
+  std::uint64_t checksum(const void* data, std::size_t size, std::uint64_t h) {
+
+    const char* p = static_cast<const char*>(data);
+    for (std::size_t i = 0; i < size; i += 8)
+    {
+        std::uint64_t w;
+        std::memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+    }
+    return h;
+  }
+
+  std::uint64_t checksum(const FeatureTransformer* ft, const Network* net) {
+
+    static_assert(sizeof(FeatureTransformer) % 8 == 0 && sizeof(Network) % 8 == 0);
+    return checksum(net, sizeof(Network), checksum(ft, sizeof(FeatureTransformer), 0));
+  }
+
+  // Accumulator cache of the thread of the position, if any
+  AccumulatorCache* accumulator_cache(const Position& pos) {
+
+    Thread* th = pos.this_thread();
+    if (!th)
+        return nullptr;
+
+    if (th->accumulatorCache.epoch != netEpoch)
+        th->accumulatorCache.clear(netEpoch);
+
+    return &th->accumulatorCache;
+  }
+
+  // Evaluation cache of the thread of the position, if any and enabled
+  EvalCache* eval_cache(const Position& pos) {
+
+    Thread* th = pos.this_thread();
+    if (!th || !th->evalCache.enabled())
+        return nullptr;
+
+    if (th->evalCache.epoch != netEpoch)
+        th->evalCache.clear(netEpoch);
+
+    return &th->evalCache;
+  }
+
+  // Propagate the transformed features of a position through the network,
+  // with the fused output stack when there is one for the network.
+  std::int32_t propagate(const TransformedFeatureType* transformed_features, char* buffer) {
+
+    return Layers::FusedOutput<Network>::Propagate(*network, transformed_features, buffer);
+  }
+
   }  // namespace Detail
 
   // Initialize the evaluation function parameters
   void Initialize() {
 
-    Detail::Initialize(feature_transformer);
-    Detail::Initialize(network);
+    unmap_file(image, imageSize);
+    image = nullptr;
+
+    Detail::Initialize(featureTransformerStorage);
+    Detail::Initialize(networkStorage);
+    feature_transformer = featureTransformerStorage.get();
+    network = networkStorage.get();
   }
 
   // Read network header
@@ -98,14 +223,31 @@ namespace Eval::NNUE {
     std::string architecture;
     if (!ReadHeader(stream, &hash_value, &architecture)) return false;
     if (hash_value != kHashValue) return false;
-    if (!Detail::ReadParameters(stream, *feature_transformer)) return false;
-    if (!Detail::ReadParameters(stream, *network)) return false;
+    if (!Detail::ReadParameters(stream, *featureTransformerStorage)) return false;
+    if (!Detail::ReadParameters(stream, *networkStorage)) return false;
     return stream && stream.peek() == std::ios::traits_type::eof();
   }
 
   // Evaluation function. Perform differential calculation.
   Value evaluate(const Position& pos) {
 
+    AccumulatorCache* cache = Detail::accumulator_cache(pos);
+    EvalCache* evalCache = Detail::eval_cache(pos);
+    EvalCache::Entry* entry = nullptr;
+
+    // On a hit the accumulators are still updated, as those of the following
+    // positions are updated from them, but not transformed nor propagated.
+    if (evalCache)
+    {
+        bool found;
+        entry = evalCache->probe(pos.key(), found);
+        if (found)
+        {
+            feature_transformer->UpdateAccumulators(pos, cache);
+            return static_cast<Value>(entry->value);
+        }
+    }
+
     // We manually align the arrays on the stack because with gcc < 9.3
     // overaligning stack variables with alignas() doesn't work correctly.
 
@@ -127,10 +269,170 @@ namespace Eval::NNUE {
     ASSERT_ALIGNED(transformed_features, alignment);
     ASSERT_ALIGNED(buffer, alignment);
 
-    feature_transformer->Transform(pos, transformed_features);
-    const auto output = network->Propagate(transformed_features, buffer);
+    feature_transformer->Transform(pos, transformed_features, cache);
+
+    if (cache && cache->densityStats)
+    {
+        constexpr IndexType kChunks = FeatureTransformer::kOutputDimensions / 4;
+        const IndexType n = Layers::CountNonZeroChunks<FeatureTransformer::kOutputDimensions>(transformed_features);
+        cache->density[n * (AccumulatorCache::kDensityBuckets - 1) / kChunks]++;
+    }
+
+    const Value v = static_cast<Value>(Detail::propagate(transformed_features, buffer) / FV_SCALE);
 
-    return static_cast<Value>(output[0] / FV_SCALE);
+    if (entry)
+        entry->key32 = std::uint32_t(pos.key() >> 32), entry->value = v;
+
+    return v;
+  }
+
+  // Evaluation of a batch of positions. Each position gets its own block of
+  // scratch memory, holding its transformed features followed by its network
+  // buffer, so that the network can be propagated over the whole batch at once.
+  void evaluate(const Position* const* positions, std::size_t count, Value* values) {
+
+    constexpr std::size_t kBatchSize = 64;
+    constexpr std::size_t kFeaturesSize =
+        CeilToMultiple(FeatureTransformer::kBufferSize * sizeof(TransformedFeatureType), kCacheLineSize);
+    constexpr std::size_t kStride = kFeaturesSize + CeilToMultiple(Network::kBufferSize, kCacheLineSize);
+
+    char* scratch = static_cast<char*>(std_aligned_alloc(kCacheLineSize, kBatchSize * kStride));
+    if (!scratch)
+    {
+        std::cerr << "Failed to allocate the NNUE batch evaluation buffer." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    for (std::size_t first = 0; first < count; first += kBatchSize)
+    {
+        const std::size_t n = std::min(kBatchSize, count - first);
+
+        for (std::size_t b = 0; b < n; ++b)
+            feature_transformer->Transform(*positions[first + b],
+                reinterpret_cast<TransformedFeatureType*>(scratch + b * kStride),
+                Detail::accumulator_cache(*positions[first + b]));
+
+        const auto output = network->Propagate(
+            reinterpret_cast<TransformedFeatureType*>(scratch), scratch + kFeaturesSize, IndexType(n), kStride);
+
+        for (std::size_t b = 0; b < n; ++b)
+            values[first + b] = static_cast<Value>(
+                *reinterpret_cast<const Network::OutputType*>(
+                    reinterpret_cast<const char*>(output) + b * kStride) / FV_SCALE);
+    }
+
+    std_aligned_free(scratch);
+  }
+
+  // Microbenchmark of the evaluation function: time the feature transform and
+  // the propagation through the network of the given position, and the update
+  // of the accumulators after a move, in nanoseconds and, on x86, in time stamp
+  // counter cycles per call.
+  std::string benchmark(Position& pos, int iterations) {
+
+    constexpr std::size_t kFeaturesSize =
+        CeilToMultiple(FeatureTransformer::kBufferSize * sizeof(TransformedFeatureType), kCacheLineSize);
+
+    char* scratch = static_cast<char*>(std_aligned_alloc(kCacheLineSize, kFeaturesSize + Network::kBufferSize));
+    if (!scratch)
+    {
+        std::cerr << "Failed to allocate the NNUE benchmark buffer." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    auto* transformed_features = reinterpret_cast<TransformedFeatureType*>(scratch);
+    char* buffer = scratch + kFeaturesSize;
+
+    auto cycles = []() -> std::uint64_t {
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+      return __rdtsc();
+#else
+      return 0;
+#endif
+    };
+
+    std::stringstream ss;
+    std::int64_t checksum = 0;
+
+    auto measure = [&](const char* name, auto&& run) {
+      run(); // Warm up caches and compute the accumulator
+      auto start = std::chrono::steady_clock::now();
+      std::uint64_t startCycles = cycles();
+      for (int i = 0; i < iterations; ++i)
+          checksum += run();
+      std::uint64_t elapsedCycles = cycles() - startCycles;
+      double ns = std::chrono::duration<double, std::nano>(
+                      std::chrono::steady_clock::now() - start).count();
+
+      ss << std::left << std::setw(12) << name << ": "
+         << std::fixed << std::setprecision(1) << ns / iterations << " ns";
+      if (elapsedCycles)
+          ss << ", " << double(elapsedCycles) / iterations << " cycles";
+      ss << " per call\n";
+    };
+
+    measure("Transform", [&]() {
+      feature_transformer->Transform(pos, transformed_features, Detail::accumulator_cache(pos));
+      return std::int64_t(transformed_features[0]);
+    });
+
+    measure("Propagate", [&]() {
+      return std::int64_t(Detail::propagate(transformed_features, buffer));
+    });
+
+    if (Layers::FusedOutput<Network>::kEnabled)
+        measure("Layer chain", [&]() {
+          return std::int64_t(network->Propagate(transformed_features, buffer)[0]);
+        });
+
+    // Update of both accumulators after each of the legal moves in turn, which
+    // streams the weights of the features changed by the move. King moves
+    // refresh the accumulator of their side instead.
+    MoveList<LEGAL> moves(pos);
+    std::size_t next = 0;
+    StateInfo st;
+
+    if (moves.size())
+        measure("Update", [&]() {
+          const Move m = moves.begin()[next++ % moves.size()];
+          pos.do_move(m, st);
+          feature_transformer->Transform(pos, transformed_features, Detail::accumulator_cache(pos));
+          pos.undo_move(m);
+          return std::int64_t(transformed_features[0]);
+        });
+
+    // The batched evaluation of the positions after the legal moves must give
+    // the values of their evaluations one by one. The batch comes first, so
+    // that it also computes the accumulators of the positions.
+    std::vector<std::string> fens;
+    for (const Move m : moves)
+    {
+        pos.do_move(m, st);
+        fens.push_back(pos.fen());
+        pos.undo_move(m);
+    }
+
+    std::deque<StateInfo> states(fens.size());
+    std::vector<std::unique_ptr<Position>> children;
+    std::vector<const Position*> batch;
+    for (std::size_t i = 0; i < fens.size(); ++i)
+    {
+        children.emplace_back(new Position);
+        children.back()->set(fens[i], pos.is_chess960(), &states[i], pos.this_thread());
+        batch.push_back(children.back().get());
+    }
+
+    std::vector<Value> values(batch.size());
+    evaluate(batch.data(), batch.size(), values.data());
+
+    int mismatches = 0;
+    for (std::size_t i = 0; i < batch.size(); ++i)
+        mismatches += values[i] != evaluate(*batch[i]);
+
+    ss << "Batch       : " << batch.size() << " positions, " << mismatches << " mismatches\n";
+    ss << "Iterations  : " << iterations << " (checksum " << checksum << ")";
+
+    std_aligned_free(scratch);
+    return ss.str();
   }
 
   // Load eval, from a file stream or a memory stream
@@ -138,7 +440,150 @@ namespace Eval::NNUE {
 
     Initialize();
     fileName = name;
+    ++netEpoch;
     return ReadParameters(stream);
   }
 
+  // Map an image file written by save_image(). If the file is not an image
+  // for this build the current network is left untouched and false returned,
+  // so that the caller can fall back to reading it as a network file. The
+  // parameters are used as they are mapped, so a corrupted image must not get
+  // through: they are checksummed, and the indices they hold are checked.
+  bool map_image(std::string name, const std::string& path) {
+
+    std::size_t size = 0;
+    char* mem = static_cast<char*>(map_file(path, &size));
+    const ImageHeader* header = reinterpret_cast<const ImageHeader*>(mem);
+
+    if (   !mem
+        || size < kImageNetworkOffset + sizeof(Network)
+        || std::memcmp(header->magic, kImageMagic, sizeof(header->magic))
+        || header->version != kImageVersion
+        || header->hashValue != kHashValue
+        || header->layout != kImageLayout
+        || header->featureTransformerSize != sizeof(FeatureTransformer)
+        || header->networkSize != sizeof(Network))
+    {
+        unmap_file(mem, size);
+        return false;
+    }
+
+    auto ft  = reinterpret_cast<const FeatureTransformer*>(mem + kImageFeatureTransformerOffset);
+    auto net = reinterpret_cast<const Network*>(mem + kImageNetworkOffset);
+
+    if (   header->checksum != Detail::checksum(ft, net)
+        || !net->VerifyParameters())
+    {
+        unmap_file(mem, size);
+        return false;
+    }
+
+    unmap_file(image, imageSize);
+    featureTransformerStorage.reset();
+    networkStorage.reset();
+
+    image = mem;
+    imageSize = size;
+    feature_transformer = ft;
+    network = net;
+    fileName = name;
+    ++netEpoch;
+    return true;
+  }
+
+  // Write the image of the network in use to a file
+  bool save_image(const std::string& path) {
+
+    if (!feature_transformer)
+        return false;
+
+    std::ofstream file(path, std::ios::binary);
+    ImageHeader header = {};
+
+    std::memcpy(header.magic, kImageMagic, sizeof(header.magic));
+    header.version                = kImageVersion;
+    header.hashValue              = kHashValue;
+    header.layout                 = kImageLayout;
+    header.featureTransformerSize = sizeof(FeatureTransformer);
+    header.networkSize            = sizeof(Network);
+    header.checksum               = Detail::checksum(feature_transformer, network);
+
+    const std::string padding(kImageFeatureTransformerOffset, '\0');
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(padding.data(), kImageFeatureTransformerOffset - sizeof(header));
+    file.write(reinterpret_cast<const char*>(feature_transformer), sizeof(FeatureTransformer));
+    file.write(padding.data(), kImageNetworkOffset - kImageFeatureTransformerOffset - sizeof(FeatureTransformer));
+    file.write(reinterpret_cast<const char*>(network), sizeof(Network));
+
+    return bool(file);
+  }
+
+#if defined(NNUE_TARGET)
+  // Entry points of this target, for the dispatcher below
+  extern const TargetFunctions targetFunctions = {
+    evaluate, evaluate, benchmark, load_eval, map_image, save_image
+  };
+#endif
+
+  NNUE_TARGET_END
+
+#else
+
+  // In a dispatch build this file is also compiled without NNUE_TARGET, for
+  // plain x86-64, into the functions that forward the calls to the target
+  // selected at startup from the CPU features.
+
+  namespace sse2    { extern const TargetFunctions targetFunctions; }
+  namespace sse41   { extern const TargetFunctions targetFunctions; }
+  namespace avx2    { extern const TargetFunctions targetFunctions; }
+  namespace avxvnni { extern const TargetFunctions targetFunctions; }
+  namespace avx512  { extern const TargetFunctions targetFunctions; }
+  namespace vnni512 { extern const TargetFunctions targetFunctions; }
+
+  namespace {
+
+  const TargetFunctions& select_target() {
+
+    switch (CPU::best_target())
+    {
+    case CPU::VNNI512: return vnni512::targetFunctions;
+    case CPU::AVX512:  return avx512::targetFunctions;
+    case CPU::AVXVNNI: return avxvnni::targetFunctions;
+    case CPU::AVX2:    return avx2::targetFunctions;
+    case CPU::SSE41:   return sse41::targetFunctions;
+    default:           return sse2::targetFunctions;
+    }
+  }
+
+  const TargetFunctions& target = select_target();
+
+  } // namespace
+
+  Value evaluate(const Position& pos) {
+    return target.evaluate(pos);
+  }
+
+  void evaluate(const Position* const* positions, std::size_t count, Value* values) {
+    target.evaluateBatch(positions, count, values);
+  }
+
+  std::string benchmark(Position& pos, int iterations) {
+    return target.benchmark(pos, iterations);
+  }
+
+  bool load_eval(std::string name, std::istream& stream) {
+    return target.loadEval(name, stream);
+  }
+
+  bool map_image(std::string name, const std::string& path) {
+    return target.mapImage(name, path);
+  }
+
+  bool save_image(const std::string& path) {
+    return target.saveImage(path);
+  }
+
+#endif
+
 } // namespace Eval::NNUE
@@ -54,6 +54,16 @@ namespace Eval::NNUE {
   template <typename T>
   using LargePagePtr = std::unique_ptr<T, LargePageDeleter<T>>;
 
+  // Entry points of the code compiled for one target of a dispatch build
+  struct TargetFunctions {
+    Value (*evaluate)(const Position& pos);
+    void (*evaluateBatch)(const Position* const* positions, std::size_t count, Value* values);
+    std::string (*benchmark)(Position& pos, int iterations);
+    bool (*loadEval)(std::string name, std::istream& stream);
+    bool (*mapImage)(std::string name, const std::string& path);
+    bool (*saveImage)(const std::string& path);
+  };
+
 }  // namespace Eval::NNUE
 
 #endif // #ifndef NNUE_EVALUATE_NNUE_H_INCLUDED
@@ -63,6 +63,26 @@ namespace Eval::NNUE::Features {
     }
   }
 
+  // Get a list of indices for the features that differ from an earlier position
+  template <Side AssociatedKing>
+  void HalfKP<AssociatedKing>::AppendChangedIndices(
+      const Position& pos, const Bitboard* byColorBB, const Bitboard* byTypeBB,
+      Color perspective, IndexList* removed, IndexList* added) {
+
+    Square ksq = orient(perspective, pos.square<KING>(perspective));
+    for (Color c : { WHITE, BLACK })
+      for (PieceType pt = PAWN; pt < KING; ++pt) {
+        Piece pc = make_piece(c, pt);
+        Bitboard before = byColorBB[c] & byTypeBB[pt];
+        Bitboard removedBB = before & ~pos.pieces(c, pt);
+        Bitboard addedBB = pos.pieces(c, pt) & ~before;
+        while (removedBB)
+          removed->push_back(make_index(perspective, pop_lsb(&removedBB), pc, ksq));
+        while (addedBB)
+          added->push_back(make_index(perspective, pop_lsb(&addedBB), pc, ksq));
+      }
+  }
+
   template class HalfKP<Side::kFriend>;
 
 }  // namespace Eval::NNUE::Features
@@ -52,6 +52,12 @@ namespace Eval::NNUE::Features {
     // Get a list of indices for recently changed features
     static void AppendChangedIndices(const Position& pos, const DirtyPiece& dp, Color perspective,
                                      IndexList* removed, IndexList* added);
+
+    // Get a list of indices for the features that differ from the ones of an
+    // earlier position with the same king square, given by its bitboards
+    static void AppendChangedIndices(const Position& pos, const Bitboard* byColorBB,
+                                     const Bitboard* byTypeBB, Color perspective,
+                                     IndexList* removed, IndexList* added);
   };
 
 }  // namespace Eval::NNUE::Features
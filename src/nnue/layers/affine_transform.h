@@ -22,10 +22,66 @@
 #define NNUE_LAYERS_AFFINE_TRANSFORM_H_INCLUDED
 
 #include <iostream>
+#include "../../bitboard.h"
 #include "../nnue_common.h"
+#include "simd.h"
 
 namespace Eval::NNUE::Layers {
 
+  NNUE_TARGET_BEGIN
+
+  // Chunks of 4 inputs are tested with SIMD compares of 32 bit lanes, a block
+  // of kNonZeroBlock chunks at a time. Size must be a multiple of kMaxSimdWidth.
+#if defined (USE_AVX512)
+  constexpr IndexType kNonZeroBlock = 16;
+#elif defined (USE_AVX2)
+  constexpr IndexType kNonZeroBlock = 8;
+#elif defined (USE_SSE2)
+  constexpr IndexType kNonZeroBlock = 4;
+#else
+  constexpr IndexType kNonZeroBlock = 1;
+#endif
+
+  // Bitmask of the chunks of the given block which are not all zero
+  inline Bitboard NonZeroChunks(const std::uint8_t* input, IndexType block) {
+
+#if defined (USE_AVX512)
+    const __m512i v = reinterpret_cast<const __m512i*>(input)[block];
+    return _mm512_test_epi32_mask(v, v);
+#elif defined (USE_AVX2)
+    const __m256i v = reinterpret_cast<const __m256i*>(input)[block];
+    return 0xFF ^ _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, _mm256_setzero_si256())));
+#elif defined (USE_SSE2)
+    const __m128i v = reinterpret_cast<const __m128i*>(input)[block];
+    return 0xF ^ _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, _mm_setzero_si128())));
+#else
+    std::uint32_t v;
+    std::memcpy(&v, input + 4 * block, 4);
+    return v != 0;
+#endif
+  }
+
+  // Number of the chunks of 4 inputs which are not all zero
+  template <IndexType Size>
+  IndexType CountNonZeroChunks(const std::uint8_t* input) {
+
+    IndexType count = 0;
+    for (IndexType i = 0; i < Size / 4 / kNonZeroBlock; ++i)
+      count += popcount(NonZeroChunks(input, i));
+    return count;
+  }
+
+  // Indices of the chunks of 4 inputs which are not all zero, written to nnz
+  template <IndexType Size>
+  IndexType FindNonZeroChunks(const std::uint8_t* input, std::uint16_t* nnz) {
+
+    IndexType count = 0;
+    for (IndexType i = 0; i < Size / 4 / kNonZeroBlock; ++i)
+      for (Bitboard mask = NonZeroChunks(input, i); mask; )
+        nnz[count++] = std::uint16_t(i * kNonZeroBlock + pop_lsb(&mask));
+    return count;
+  }
+
   // Affine transformation layer
   template <typename PreviousLayer, IndexType OutputDimensions>
   class AffineTransform {
@@ -47,6 +103,19 @@ namespace Eval::NNUE::Layers {
     static constexpr const IndexType kOutputSimdWidth = kSimdWidth / 4;
 #endif
 
+    // The input of the first layer, the transformed features, may be sparse as
+    // many of them are clipped to zero. When few of its chunks of 4 inputs are
+    // not all zero, only these are propagated. A sparse chunk costs about twice
+    // a dense one, which sums the products of 4 chunks in 16 bits at once. The
+    // inputs of the default net are too dense for that, so the count of the
+    // non-zero chunks is only paid for in builds with sparse=yes.
+#if defined(NNUE_SPARSE_INPUT)
+    static constexpr bool kSparseInput = kInputDimensions >= 256;
+#else
+    static constexpr bool kSparseInput = false;
+#endif
+    static constexpr IndexType kSparseMaxChunks = kPaddedInputDimensions / 4 * 3 / 8;
+
     // Size of forward propagation buffer used in this layer
     static constexpr std::size_t kSelfBufferSize =
         CeilToMultiple(kOutputDimensions * sizeof(OutputType), kCacheLineSize);
@@ -125,152 +194,72 @@ namespace Eval::NNUE::Layers {
       return !stream.fail();
     }
 
+    // Check network parameters that were not read from a stream, as those of
+    // a mapped image: the weights split out must index the layer dimensions
+    bool VerifyParameters() const {
+      if (!previous_layer_.VerifyParameters()) return false;
+#if defined (USE_SSSE3)
+      constexpr int kMaxCount = int(sizeof(canSaturate16.ids) / sizeof(canSaturate16.ids[0]));
+      if (canSaturate16.count < 0 || canSaturate16.count > kMaxCount) return false;
+      for (int i = 0; i < canSaturate16.count; ++i)
+        if (   canSaturate16.ids[i].out >= kOutputDimensions
+            || canSaturate16.ids[i].in >= kInputDimensions)
+          return false;
+#endif
+      return true;
+    }
+
     // Forward propagation
     const OutputType* Propagate(
         const TransformedFeatureType* transformed_features, char* buffer) const {
-      const auto input = previous_layer_.Propagate(
-          transformed_features, buffer + kSelfBufferSize);
-
-#if defined (USE_AVX512)
-
-      [[maybe_unused]] const __m512i kOnes512 = _mm512_set1_epi16(1);
-
-      [[maybe_unused]] auto m512_hadd = [](__m512i sum, int bias) -> int {
-        return _mm512_reduce_add_epi32(sum) + bias;
-      };
-
-      [[maybe_unused]] auto m512_add_dpbusd_epi32 = [=](__m512i& acc, __m512i a, __m512i b) {
-#if defined (USE_VNNI)
-        acc = _mm512_dpbusd_epi32(acc, a, b);
-#else
-        __m512i product0 = _mm512_maddubs_epi16(a, b);
-        product0 = _mm512_madd_epi16(product0, kOnes512);
-        acc = _mm512_add_epi32(acc, product0);
-#endif
-      };
-
-      [[maybe_unused]] auto m512_add_dpbusd_epi32x4 = [=](__m512i& acc, __m512i a0, __m512i b0, __m512i a1, __m512i b1,
-                                                                        __m512i a2, __m512i b2, __m512i a3, __m512i b3) {
-#if defined (USE_VNNI)
-        acc = _mm512_dpbusd_epi32(acc, a0, b0);
-        acc = _mm512_dpbusd_epi32(acc, a1, b1);
-        acc = _mm512_dpbusd_epi32(acc, a2, b2);
-        acc = _mm512_dpbusd_epi32(acc, a3, b3);
-#else
-        __m512i product0 = _mm512_maddubs_epi16(a0, b0);
-        __m512i product1 = _mm512_maddubs_epi16(a1, b1);
-        __m512i product2 = _mm512_maddubs_epi16(a2, b2);
-        __m512i product3 = _mm512_maddubs_epi16(a3, b3);
-        product0 = _mm512_add_epi16(product0, product1);
-        product2 = _mm512_add_epi16(product2, product3);
-        product0 = _mm512_add_epi16(product0, product2);
-        product0 = _mm512_madd_epi16(product0, kOnes512);
-        acc = _mm512_add_epi32(acc, product0);
-#endif
-      };
-
-#endif
-#if defined (USE_AVX2)
-
-      [[maybe_unused]] const __m256i kOnes256 = _mm256_set1_epi16(1);
-
-      [[maybe_unused]] auto m256_hadd = [](__m256i sum, int bias) -> int {
-        __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
-        sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_PERM_BADC));
-        sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_PERM_CDAB));
-        return _mm_cvtsi128_si32(sum128) + bias;
-      };
-
-      [[maybe_unused]] auto m256_add_dpbusd_epi32 = [=](__m256i& acc, __m256i a, __m256i b) {
-#if defined (USE_VNNI)
-        acc = _mm256_dpbusd_epi32(acc, a, b);
-#else
-        __m256i product0 = _mm256_maddubs_epi16(a, b);
-        product0 = _mm256_madd_epi16(product0, kOnes256);
-        acc = _mm256_add_epi32(acc, product0);
-#endif
-      };
-
-      [[maybe_unused]] auto m256_add_dpbusd_epi32x4 = [=](__m256i& acc, __m256i a0, __m256i b0, __m256i a1, __m256i b1,
-                                                                        __m256i a2, __m256i b2, __m256i a3, __m256i b3) {
-#if defined (USE_VNNI)
-        acc = _mm256_dpbusd_epi32(acc, a0, b0);
-        acc = _mm256_dpbusd_epi32(acc, a1, b1);
-        acc = _mm256_dpbusd_epi32(acc, a2, b2);
-        acc = _mm256_dpbusd_epi32(acc, a3, b3);
-#else
-        __m256i product0 = _mm256_maddubs_epi16(a0, b0);
-        __m256i product1 = _mm256_maddubs_epi16(a1, b1);
-        __m256i product2 = _mm256_maddubs_epi16(a2, b2);
-        __m256i product3 = _mm256_maddubs_epi16(a3, b3);
-        product0 = _mm256_add_epi16(product0, product1);
-        product2 = _mm256_add_epi16(product2, product3);
-        product0 = _mm256_add_epi16(product0, product2);
-        product0 = _mm256_madd_epi16(product0, kOnes256);
-        acc = _mm256_add_epi32(acc, product0);
-#endif
-      };
-
-#endif
-#if defined (USE_SSSE3)
-
-      [[maybe_unused]] const __m128i kOnes128 = _mm_set1_epi16(1);
-
-      [[maybe_unused]] auto m128_hadd = [](__m128i sum, int bias) -> int {
-        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E)); //_MM_PERM_BADC
-        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1)); //_MM_PERM_CDAB
-        return _mm_cvtsi128_si32(sum) + bias;
-      };
+      return Propagate(transformed_features, buffer, 1, 0);
+    }
 
-      [[maybe_unused]] auto m128_add_dpbusd_epi32 = [=](__m128i& acc, __m128i a, __m128i b) {
-        __m128i product0 = _mm_maddubs_epi16(a, b);
-        product0 = _mm_madd_epi16(product0, kOnes128);
-        acc = _mm_add_epi32(acc, product0);
+    // Forward propagation of a batch of positions. The transformed features
+    // and the buffers of the positions are laid out every stride bytes, and
+    // so are the returned outputs. When the weights are walked in the outer
+    // loop, each chunk of them is applied to all the positions of the batch
+    // while it is in registers, as a matrix-matrix product.
+    const OutputType* Propagate(
+        const TransformedFeatureType* transformed_features, char* buffer,
+        IndexType count, std::size_t stride) const {
+      const auto input_batch = previous_layer_.Propagate(
+          transformed_features, buffer + kSelfBufferSize, count, stride);
+
+      // Input and output of the b-th position of the batch
+      auto input_at = [=](IndexType b) {
+        return reinterpret_cast<const InputType*>(
+            reinterpret_cast<const char*>(input_batch) + b * stride);
       };
-
-      [[maybe_unused]] auto m128_add_dpbusd_epi32x4 = [=](__m128i& acc, __m128i a0, __m128i b0, __m128i a1, __m128i b1,
-                                                                        __m128i a2, __m128i b2, __m128i a3, __m128i b3) {
-        __m128i product0 = _mm_maddubs_epi16(a0, b0);
-        __m128i product1 = _mm_maddubs_epi16(a1, b1);
-        __m128i product2 = _mm_maddubs_epi16(a2, b2);
-        __m128i product3 = _mm_maddubs_epi16(a3, b3);
-        product0 = _mm_adds_epi16(product0, product1);
-        product2 = _mm_adds_epi16(product2, product3);
-        product0 = _mm_adds_epi16(product0, product2);
-        product0 = _mm_madd_epi16(product0, kOnes128);
-        acc = _mm_add_epi32(acc, product0);
+      auto output_at = [=](IndexType b) {
+        return reinterpret_cast<OutputType*>(buffer + b * stride);
       };
 
-#endif
-
 #if defined (USE_AVX512)
       using vec_t = __m512i;
       #define vec_setzero _mm512_setzero_si512
       #define vec_set_32 _mm512_set1_epi32
-      auto& vec_add_dpbusd_32 = m512_add_dpbusd_epi32;
-      auto& vec_add_dpbusd_32x4 = m512_add_dpbusd_epi32x4;
-      auto& vec_hadd = m512_hadd;
+      auto& vec_add_dpbusd_32 = Simd::m512_add_dpbusd_epi32;
+      auto& vec_add_dpbusd_32x4 = Simd::m512_add_dpbusd_epi32x4;
+      auto& vec_hadd = Simd::m512_hadd;
 #elif defined (USE_AVX2)
       using vec_t = __m256i;
       #define vec_setzero _mm256_setzero_si256
       #define vec_set_32 _mm256_set1_epi32
-      auto& vec_add_dpbusd_32 = m256_add_dpbusd_epi32;
-      auto& vec_add_dpbusd_32x4 = m256_add_dpbusd_epi32x4;
-      auto& vec_hadd = m256_hadd;
+      auto& vec_add_dpbusd_32 = Simd::m256_add_dpbusd_epi32;
+      auto& vec_add_dpbusd_32x4 = Simd::m256_add_dpbusd_epi32x4;
+      auto& vec_hadd = Simd::m256_hadd;
 #elif defined (USE_SSSE3)
       using vec_t = __m128i;
       #define vec_setzero _mm_setzero_si128
       #define vec_set_32 _mm_set1_epi32
-      auto& vec_add_dpbusd_32 = m128_add_dpbusd_epi32;
-      auto& vec_add_dpbusd_32x4 = m128_add_dpbusd_epi32x4;
-      auto& vec_hadd = m128_hadd;
+      auto& vec_add_dpbusd_32 = Simd::m128_add_dpbusd_epi32;
+      auto& vec_add_dpbusd_32x4 = Simd::m128_add_dpbusd_epi32x4;
+      auto& vec_hadd = Simd::m128_hadd;
 #endif
 
 #if defined (USE_SSSE3)
 
-      const auto output = reinterpret_cast<OutputType*>(buffer);
-      const auto input_vector = reinterpret_cast<const vec_t*>(input);
-
       static_assert(kOutputDimensions % kOutputSimdWidth == 0 || kOutputDimensions == 1);
 
       // kOutputDimensions is either 1 or a multiple of kSimdWidth
@@ -279,61 +268,113 @@ namespace Eval::NNUE::Layers {
       {
           constexpr IndexType kNumChunks = kPaddedInputDimensions / 4;
 
-          const auto input32 = reinterpret_cast<const std::int32_t*>(input);
-          vec_t* outptr = reinterpret_cast<vec_t*>(output);
-          std::memcpy(output, biases_, kOutputDimensions * sizeof(OutputType));
+          for (IndexType b = 0; b < count; ++b)
+              std::memcpy(output_at(b), biases_, kOutputDimensions * sizeof(OutputType));
+
+          // The products of a chunk are summed in 32 bits. The result is the
+          // same as the one of the dense loop below, whose 16 bit sums of 4
+          // chunks cannot saturate once canSaturate16 has been taken out.
+          // Batches keep the dense loop, which applies each chunk of weights to
+          // all the positions of the batch.
+          if (   kSparseInput
+              && count == 1
+              && CountNonZeroChunks<kPaddedInputDimensions>(input_at(0)) <= kSparseMaxChunks)
+          {
+              constexpr IndexType kNumRegs = (kOutputDimensions + kOutputSimdWidth - 1) / kOutputSimdWidth;
+
+              std::uint16_t nnz[kNumChunks];
+              const IndexType nnzCount = FindNonZeroChunks<kPaddedInputDimensions>(input_at(0), nnz);
+              const auto input32 = reinterpret_cast<const std::int32_t*>(input_at(0));
+              vec_t* outptr = reinterpret_cast<vec_t*>(output_at(0));
+              vec_t acc[kNumRegs];
+
+              for (IndexType j = 0; j < kNumRegs; ++j)
+                  acc[j] = outptr[j];
+
+              for (IndexType k = 0; k < nnzCount; ++k)
+              {
+                  const IndexType i = nnz[k];
+                  const auto col = reinterpret_cast<const vec_t*>(&weights_[i * kOutputDimensions * 4]);
+                  const vec_t in = vec_set_32(input32[i]);
+                  for (IndexType j = 0; j < kNumRegs; ++j)
+                      vec_add_dpbusd_32(acc[j], in, col[j]);
+              }
+
+              for (IndexType j = 0; j < kNumRegs; ++j)
+                  outptr[j] = acc[j];
+          }
+          else
+          {
+              for (int i = 0; i < (int)kNumChunks - 3; i += 4)
+              {
+                  const auto col0 = reinterpret_cast<const vec_t*>(&weights_[(i + 0) * kOutputDimensions * 4]);
+                  const auto col1 = reinterpret_cast<const vec_t*>(&weights_[(i + 1) * kOutputDimensions * 4]);
+                  const auto col2 = reinterpret_cast<const vec_t*>(&weights_[(i + 2) * kOutputDimensions * 4]);
+                  const auto col3 = reinterpret_cast<const vec_t*>(&weights_[(i + 3) * kOutputDimensions * 4]);
+
+                  for (IndexType b = 0; b < count; ++b)
+                  {
+                      const auto input32 = reinterpret_cast<const std::int32_t*>(input_at(b));
+                      vec_t* outptr = reinterpret_cast<vec_t*>(output_at(b));
+                      const vec_t in0 = vec_set_32(input32[i + 0]);
+                      const vec_t in1 = vec_set_32(input32[i + 1]);
+                      const vec_t in2 = vec_set_32(input32[i + 2]);
+                      const vec_t in3 = vec_set_32(input32[i + 3]);
+                      for (int j = 0; j * kOutputSimdWidth < kOutputDimensions; ++j)
+                          vec_add_dpbusd_32x4(outptr[j], in0, col0[j], in1, col1[j], in2, col2[j], in3, col3[j]);
+                  }
+              }
+          }
 
-          for (int i = 0; i < (int)kNumChunks - 3; i += 4)
+          for (IndexType b = 0; b < count; ++b)
           {
-              const vec_t in0 = vec_set_32(input32[i + 0]);
-              const vec_t in1 = vec_set_32(input32[i + 1]);
-              const vec_t in2 = vec_set_32(input32[i + 2]);
-              const vec_t in3 = vec_set_32(input32[i + 3]);
-              const auto col0 = reinterpret_cast<const vec_t*>(&weights_[(i + 0) * kOutputDimensions * 4]);
-              const auto col1 = reinterpret_cast<const vec_t*>(&weights_[(i + 1) * kOutputDimensions * 4]);
-              const auto col2 = reinterpret_cast<const vec_t*>(&weights_[(i + 2) * kOutputDimensions * 4]);
-              const auto col3 = reinterpret_cast<const vec_t*>(&weights_[(i + 3) * kOutputDimensions * 4]);
-              for (int j = 0; j * kOutputSimdWidth < kOutputDimensions; ++j)
-                  vec_add_dpbusd_32x4(outptr[j], in0, col0[j], in1, col1[j], in2, col2[j], in3, col3[j]);
+              const auto input = input_at(b);
+              const auto output = output_at(b);
+              for (int i = 0; i < canSaturate16.count; ++i)
+                  output[canSaturate16.ids[i].out] += input[canSaturate16.ids[i].in] * canSaturate16.ids[i].w;
           }
-          for (int i = 0; i < canSaturate16.count; ++i)
-              output[canSaturate16.ids[i].out] += input[canSaturate16.ids[i].in] * canSaturate16.ids[i].w;
       }
       else if constexpr (kOutputDimensions == 1)
       {
-#if defined (USE_AVX512)
-          if constexpr (kPaddedInputDimensions % (kSimdWidth * 2) != 0)
+          for (IndexType b = 0; b < count; ++b)
           {
-              constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
-              const auto input_vector256 = reinterpret_cast<const __m256i*>(input);
-
-              __m256i sum0 = _mm256_setzero_si256();
-              const auto row0 = reinterpret_cast<const __m256i*>(&weights_[0]);
+              const auto output = output_at(b);
+              const auto input_vector = reinterpret_cast<const vec_t*>(input_at(b));
 
-              for (int j = 0; j < (int)kNumChunks; ++j)
+#if defined (USE_AVX512)
+              if constexpr (kPaddedInputDimensions % (kSimdWidth * 2) != 0)
               {
-                  const __m256i in = input_vector256[j];
-                  m256_add_dpbusd_epi32(sum0, in, row0[j]);
+                  constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
+                  const auto input_vector256 = reinterpret_cast<const __m256i*>(input_at(b));
+
+                  __m256i sum0 = _mm256_setzero_si256();
+                  const auto row0 = reinterpret_cast<const __m256i*>(&weights_[0]);
+
+                  for (int j = 0; j < (int)kNumChunks; ++j)
+                  {
+                      const __m256i in = input_vector256[j];
+                      Simd::m256_add_dpbusd_epi32(sum0, in, row0[j]);
+                  }
+                  output[0] = Simd::m256_hadd(sum0, biases_[0]);
               }
-              output[0] = m256_hadd(sum0, biases_[0]);
-          }
-          else
+              else
 #endif
-          {
+              {
 #if defined (USE_AVX512)
-              constexpr IndexType kNumChunks = kPaddedInputDimensions / (kSimdWidth * 2);
+                  constexpr IndexType kNumChunks = kPaddedInputDimensions / (kSimdWidth * 2);
 #else
-              constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
+                  constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
 #endif
-              vec_t sum0 = vec_setzero();
-              const auto row0 = reinterpret_cast<const vec_t*>(&weights_[0]);
+                  vec_t sum0 = vec_setzero();
+                  const auto row0 = reinterpret_cast<const vec_t*>(&weights_[0]);
 
-              for (int j = 0; j < (int)kNumChunks; ++j)
-              {
-                  const vec_t in = input_vector[j];
-                  vec_add_dpbusd_32(sum0, in, row0[j]);
+                  for (int j = 0; j < (int)kNumChunks; ++j)
+                  {
+                      const vec_t in = input_vector[j];
+                      vec_add_dpbusd_32(sum0, in, row0[j]);
+                  }
+                  output[0] = vec_hadd(sum0, biases_[0]);
               }
-              output[0] = vec_hadd(sum0, biases_[0]);
           }
       }
 
@@ -341,87 +382,90 @@ namespace Eval::NNUE::Layers {
 
 // Use old implementation for the other architectures.
 
-      auto output = reinterpret_cast<OutputType*>(buffer);
+      for (IndexType b = 0; b < count; ++b) {
+        const auto input = input_at(b);
+        const auto output = output_at(b);
 
 #if defined(USE_SSE2)
-      constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
-      const __m128i kZeros = _mm_setzero_si128();
-      const auto input_vector = reinterpret_cast<const __m128i*>(input);
+        constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
+        const __m128i kZeros = _mm_setzero_si128();
+        const auto input_vector = reinterpret_cast<const __m128i*>(input);
 
 #elif defined(USE_MMX)
-      constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
-      const __m64 kZeros = _mm_setzero_si64();
-      const auto input_vector = reinterpret_cast<const __m64*>(input);
+        constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
+        const __m64 kZeros = _mm_setzero_si64();
+        const auto input_vector = reinterpret_cast<const __m64*>(input);
 
 #elif defined(USE_NEON)
-      constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
-      const auto input_vector = reinterpret_cast<const int8x8_t*>(input);
+        constexpr IndexType kNumChunks = kPaddedInputDimensions / kSimdWidth;
+        const auto input_vector = reinterpret_cast<const int8x8_t*>(input);
 #endif
 
-      for (IndexType i = 0; i < kOutputDimensions; ++i) {
-        const IndexType offset = i * kPaddedInputDimensions;
+        for (IndexType i = 0; i < kOutputDimensions; ++i) {
+          const IndexType offset = i * kPaddedInputDimensions;
 
 #if defined(USE_SSE2)
-        __m128i sum_lo = _mm_cvtsi32_si128(biases_[i]);
-        __m128i sum_hi = kZeros;
-        const auto row = reinterpret_cast<const __m128i*>(&weights_[offset]);
-        for (IndexType j = 0; j < kNumChunks; ++j) {
-          __m128i row_j = _mm_load_si128(&row[j]);
-          __m128i input_j = _mm_load_si128(&input_vector[j]);
-          __m128i extended_row_lo = _mm_srai_epi16(_mm_unpacklo_epi8(row_j, row_j), 8);
-          __m128i extended_row_hi = _mm_srai_epi16(_mm_unpackhi_epi8(row_j, row_j), 8);
-          __m128i extended_input_lo = _mm_unpacklo_epi8(input_j, kZeros);
-          __m128i extended_input_hi = _mm_unpackhi_epi8(input_j, kZeros);
-          __m128i product_lo = _mm_madd_epi16(extended_row_lo, extended_input_lo);
-          __m128i product_hi = _mm_madd_epi16(extended_row_hi, extended_input_hi);
-          sum_lo = _mm_add_epi32(sum_lo, product_lo);
-          sum_hi = _mm_add_epi32(sum_hi, product_hi);
-        }
-        __m128i sum = _mm_add_epi32(sum_lo, sum_hi);
-        __m128i sum_high_64 = _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2));
-        sum = _mm_add_epi32(sum, sum_high_64);
-        __m128i sum_second_32 = _mm_shufflelo_epi16(sum, _MM_SHUFFLE(1, 0, 3, 2));
-        sum = _mm_add_epi32(sum, sum_second_32);
-        output[i] = _mm_cvtsi128_si32(sum);
+          __m128i sum_lo = _mm_cvtsi32_si128(biases_[i]);
+          __m128i sum_hi = kZeros;
+          const auto row = reinterpret_cast<const __m128i*>(&weights_[offset]);
+          for (IndexType j = 0; j < kNumChunks; ++j) {
+            __m128i row_j = _mm_load_si128(&row[j]);
+            __m128i input_j = _mm_load_si128(&input_vector[j]);
+            __m128i extended_row_lo = _mm_srai_epi16(_mm_unpacklo_epi8(row_j, row_j), 8);
+            __m128i extended_row_hi = _mm_srai_epi16(_mm_unpackhi_epi8(row_j, row_j), 8);
+            __m128i extended_input_lo = _mm_unpacklo_epi8(input_j, kZeros);
+            __m128i extended_input_hi = _mm_unpackhi_epi8(input_j, kZeros);
+            __m128i product_lo = _mm_madd_epi16(extended_row_lo, extended_input_lo);
+            __m128i product_hi = _mm_madd_epi16(extended_row_hi, extended_input_hi);
+            sum_lo = _mm_add_epi32(sum_lo, product_lo);
+            sum_hi = _mm_add_epi32(sum_hi, product_hi);
+          }
+          __m128i sum = _mm_add_epi32(sum_lo, sum_hi);
+          __m128i sum_high_64 = _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2));
+          sum = _mm_add_epi32(sum, sum_high_64);
+          __m128i sum_second_32 = _mm_shufflelo_epi16(sum, _MM_SHUFFLE(1, 0, 3, 2));
+          sum = _mm_add_epi32(sum, sum_second_32);
+          output[i] = _mm_cvtsi128_si32(sum);
 
 #elif defined(USE_MMX)
-        __m64 sum_lo = _mm_cvtsi32_si64(biases_[i]);
-        __m64 sum_hi = kZeros;
-        const auto row = reinterpret_cast<const __m64*>(&weights_[offset]);
-        for (IndexType j = 0; j < kNumChunks; ++j) {
-          __m64 row_j = row[j];
-          __m64 input_j = input_vector[j];
-          __m64 extended_row_lo = _mm_srai_pi16(_mm_unpacklo_pi8(row_j, row_j), 8);
-          __m64 extended_row_hi = _mm_srai_pi16(_mm_unpackhi_pi8(row_j, row_j), 8);
-          __m64 extended_input_lo = _mm_unpacklo_pi8(input_j, kZeros);
-          __m64 extended_input_hi = _mm_unpackhi_pi8(input_j, kZeros);
-          __m64 product_lo = _mm_madd_pi16(extended_row_lo, extended_input_lo);
-          __m64 product_hi = _mm_madd_pi16(extended_row_hi, extended_input_hi);
-          sum_lo = _mm_add_pi32(sum_lo, product_lo);
-          sum_hi = _mm_add_pi32(sum_hi, product_hi);
-        }
-        __m64 sum = _mm_add_pi32(sum_lo, sum_hi);
-        sum = _mm_add_pi32(sum, _mm_unpackhi_pi32(sum, sum));
-        output[i] = _mm_cvtsi64_si32(sum);
+          __m64 sum_lo = _mm_cvtsi32_si64(biases_[i]);
+          __m64 sum_hi = kZeros;
+          const auto row = reinterpret_cast<const __m64*>(&weights_[offset]);
+          for (IndexType j = 0; j < kNumChunks; ++j) {
+            __m64 row_j = row[j];
+            __m64 input_j = input_vector[j];
+            __m64 extended_row_lo = _mm_srai_pi16(_mm_unpacklo_pi8(row_j, row_j), 8);
+            __m64 extended_row_hi = _mm_srai_pi16(_mm_unpackhi_pi8(row_j, row_j), 8);
+            __m64 extended_input_lo = _mm_unpacklo_pi8(input_j, kZeros);
+            __m64 extended_input_hi = _mm_unpackhi_pi8(input_j, kZeros);
+            __m64 product_lo = _mm_madd_pi16(extended_row_lo, extended_input_lo);
+            __m64 product_hi = _mm_madd_pi16(extended_row_hi, extended_input_hi);
+            sum_lo = _mm_add_pi32(sum_lo, product_lo);
+            sum_hi = _mm_add_pi32(sum_hi, product_hi);
+          }
+          __m64 sum = _mm_add_pi32(sum_lo, sum_hi);
+          sum = _mm_add_pi32(sum, _mm_unpackhi_pi32(sum, sum));
+          output[i] = _mm_cvtsi64_si32(sum);
 
 #elif defined(USE_NEON)
-        int32x4_t sum = {biases_[i]};
-        const auto row = reinterpret_cast<const int8x8_t*>(&weights_[offset]);
-        for (IndexType j = 0; j < kNumChunks; ++j) {
-          int16x8_t product = vmull_s8(input_vector[j * 2], row[j * 2]);
-          product = vmlal_s8(product, input_vector[j * 2 + 1], row[j * 2 + 1]);
-          sum = vpadalq_s16(sum, product);
-        }
-        output[i] = sum[0] + sum[1] + sum[2] + sum[3];
+          int32x4_t sum = {biases_[i]};
+          const auto row = reinterpret_cast<const int8x8_t*>(&weights_[offset]);
+          for (IndexType j = 0; j < kNumChunks; ++j) {
+            int16x8_t product = vmull_s8(input_vector[j * 2], row[j * 2]);
+            product = vmlal_s8(product, input_vector[j * 2 + 1], row[j * 2 + 1]);
+            sum = vpadalq_s16(sum, product);
+          }
+          output[i] = sum[0] + sum[1] + sum[2] + sum[3];
 
 #else
-        OutputType sum = biases_[i];
-        for (IndexType j = 0; j < kInputDimensions; ++j) {
-          sum += weights_[offset + j] * input[j];
-        }
-        output[i] = sum;
+          OutputType sum = biases_[i];
+          for (IndexType j = 0; j < kInputDimensions; ++j) {
+            sum += weights_[offset + j] * input[j];
+          }
+          output[i] = sum;
 #endif
 
+        }
       }
 #if defined(USE_MMX)
       _mm_empty();
@@ -429,10 +473,12 @@ namespace Eval::NNUE::Layers {
 
 #endif
 
-      return output;
+      return output_at(0);
     }
 
    private:
+    template <typename> friend struct FusedOutput;
+
     using BiasType = OutputType;
     using WeightType = std::int8_t;
 
@@ -459,6 +505,8 @@ namespace Eval::NNUE::Layers {
 #endif
   };
 
+  NNUE_TARGET_END
+
 }  // namespace Eval::NNUE::Layers
 
 #endif // #ifndef NNUE_LAYERS_AFFINE_TRANSFORM_H_INCLUDED
@@ -25,6 +25,8 @@
 
 namespace Eval::NNUE::Layers {
 
+  NNUE_TARGET_BEGIN
+
   // Clipped ReLU
   template <typename PreviousLayer>
   class ClippedReLU {
@@ -59,12 +61,39 @@ namespace Eval::NNUE::Layers {
       return previous_layer_.ReadParameters(stream);
     }
 
+    // Check network parameters
+    bool VerifyParameters() const {
+      return previous_layer_.VerifyParameters();
+    }
+
     // Forward propagation
     const OutputType* Propagate(
         const TransformedFeatureType* transformed_features, char* buffer) const {
       const auto input = previous_layer_.Propagate(
           transformed_features, buffer + kSelfBufferSize);
       const auto output = reinterpret_cast<OutputType*>(buffer);
+      Clip(input, output);
+      return output;
+    }
+
+    // Forward propagation of a batch of positions, see AffineTransform
+    const OutputType* Propagate(
+        const TransformedFeatureType* transformed_features, char* buffer,
+        IndexType count, std::size_t stride) const {
+      const auto input = previous_layer_.Propagate(
+          transformed_features, buffer + kSelfBufferSize, count, stride);
+      const auto output = reinterpret_cast<OutputType*>(buffer);
+      for (IndexType b = 0; b < count; ++b)
+        Clip(reinterpret_cast<const InputType*>(reinterpret_cast<const char*>(input) + b * stride),
+             reinterpret_cast<OutputType*>(buffer + b * stride));
+      return output;
+    }
+
+   private:
+    template <typename> friend struct FusedOutput;
+
+    // Clip the outputs of the previous layer of a position
+    static void Clip(const InputType* input, OutputType* output) {
 
   #if defined(USE_AVX2)
       constexpr IndexType kNumChunks = kInputDimensions / kSimdWidth;
@@ -154,13 +183,13 @@ namespace Eval::NNUE::Layers {
         output[i] = static_cast<OutputType>(
             std::max(0, std::min(127, input[i] >> kWeightScaleBits)));
       }
-      return output;
     }
 
-   private:
     PreviousLayer previous_layer_;
   };
 
+  NNUE_TARGET_END
+
 }  // namespace Eval::NNUE::Layers
 
 #endif // NNUE_LAYERS_CLIPPED_RELU_H_INCLUDED
@@ -0,0 +1,134 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Fused propagation of the output stack of NNUE evaluation function
+
+#ifndef NNUE_LAYERS_FUSED_OUTPUT_H_INCLUDED
+#define NNUE_LAYERS_FUSED_OUTPUT_H_INCLUDED
+
+#include "../nnue_common.h"
+#include "affine_transform.h"
+#include "clipped_relu.h"
+#include "simd.h"
+
+namespace Eval::NNUE::Layers {
+
+  NNUE_TARGET_BEGIN
+
+  // The layers after the first affine transformation are small enough for a
+  // whole layer to fit in a few registers. When the network has the shape of
+  // the shipped one, they are propagated in a single function which passes the
+  // outputs of a layer to the next one in registers instead of through the
+  // buffer. Other networks and instruction sets use the chain of layers.
+  template <typename Network>
+  struct FusedOutput {
+
+    static constexpr bool kEnabled = false;
+
+    // Forward propagation, returns the output of the network
+    static std::int32_t Propagate(const Network& network,
+        const TransformedFeatureType* transformed_features, char* buffer) {
+      return network.Propagate(transformed_features, buffer)[0];
+    }
+  };
+
+#if defined (USE_AVX2)
+
+  template <typename InputLayer>
+  struct FusedOutput<AffineTransform<ClippedReLU<AffineTransform<ClippedReLU<AffineTransform<InputLayer, 32>>, 32>>, 1>> {
+
+    static constexpr bool kEnabled = true;
+
+    using Network = AffineTransform<ClippedReLU<AffineTransform<ClippedReLU<AffineTransform<InputLayer, 32>>, 32>>, 1>;
+
+    // Forward propagation, returns the output of the network
+    static std::int32_t Propagate(const Network& network,
+        const TransformedFeatureType* transformed_features, char* buffer) {
+
+      const auto& hidden2 = network.previous_layer_.previous_layer_;
+      const auto& hidden1 = hidden2.previous_layer_.previous_layer_;
+
+      // The first hidden layer reads its 512 inputs from memory anyway
+      const auto out1 = reinterpret_cast<const __m256i*>(hidden1.Propagate(transformed_features, buffer));
+      const __m256i in2 = Clip(_mm256_load_si256(&out1[0]), _mm256_load_si256(&out1[1]),
+                                _mm256_load_si256(&out1[2]), _mm256_load_si256(&out1[3]));
+
+      // Second hidden layer, each chunk of 4 inputs is broadcast from in2
+      const auto biases2 = reinterpret_cast<const __m256i*>(hidden2.biases_);
+      const auto weights2 = reinterpret_cast<const __m256i*>(hidden2.weights_);
+      __m256i out2[4] = { biases2[0], biases2[1], biases2[2], biases2[3] };
+
+      for (int i = 0; i < 8; i += 4)
+      {
+          const __m256i half = i ? _mm256_permute2x128_si256(in2, in2, 0x11)
+                                 : _mm256_permute2x128_si256(in2, in2, 0x00);
+          const __m256i c0 = _mm256_shuffle_epi32(half, 0x00);
+          const __m256i c1 = _mm256_shuffle_epi32(half, 0x55);
+          const __m256i c2 = _mm256_shuffle_epi32(half, 0xAA);
+          const __m256i c3 = _mm256_shuffle_epi32(half, 0xFF);
+          for (int j = 0; j < 4; ++j)
+              Simd::m256_add_dpbusd_epi32x4(out2[j], c0, weights2[(i + 0) * 4 + j], c1, weights2[(i + 1) * 4 + j],
+                                                     c2, weights2[(i + 2) * 4 + j], c3, weights2[(i + 3) * 4 + j]);
+      }
+
+      // The few weights split out of this layer, if any, are added to the lane
+      // of their output. Writing them to memory instead would make the reload
+      // of the outputs wait for the scalar stores.
+      if (hidden2.canSaturate16.count)
+      {
+          alignas(32) std::uint8_t input[32];
+          _mm256_store_si256(reinterpret_cast<__m256i*>(input), in2);
+
+          const __m256i kLanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+          for (int i = 0; i < hidden2.canSaturate16.count; ++i)
+          {
+              const auto& e = hidden2.canSaturate16.ids[i];
+              const __m256i product = _mm256_set1_epi32(input[e.in] * e.w);
+              const __m256i lane = _mm256_set1_epi32(e.out);
+              for (int j = 0; j < 4; ++j)
+                  out2[j] = _mm256_add_epi32(out2[j], _mm256_and_si256(product,
+                      _mm256_cmpeq_epi32(lane, _mm256_add_epi32(kLanes, _mm256_set1_epi32(j * 8)))));
+          }
+      }
+
+      // Output layer, a dot product of the 32 clipped outputs of the previous one
+      const __m256i in3 = Clip(out2[0], out2[1], out2[2], out2[3]);
+      __m256i sum = _mm256_setzero_si256();
+      Simd::m256_add_dpbusd_epi32(sum, in3, *reinterpret_cast<const __m256i*>(network.weights_));
+
+      return Simd::m256_hadd(sum, network.biases_[0]);
+    }
+
+   private:
+    // Clipped ReLU of 32 outputs, see ClippedReLU::Clip()
+    static __m256i Clip(__m256i in0, __m256i in1, __m256i in2, __m256i in3) {
+
+      const __m256i words0 = _mm256_srai_epi16(_mm256_packs_epi32(in0, in1), kWeightScaleBits);
+      const __m256i words1 = _mm256_srai_epi16(_mm256_packs_epi32(in2, in3), kWeightScaleBits);
+      return _mm256_permutevar8x32_epi32(_mm256_max_epi8(
+          _mm256_packs_epi16(words0, words1), _mm256_setzero_si256()), _mm256_set_epi32(7, 3, 6, 2, 5, 1, 4, 0));
+    }
+  };
+
+#endif
+
+  NNUE_TARGET_END
+
+}  // namespace Eval::NNUE::Layers
+
+#endif // #ifndef NNUE_LAYERS_FUSED_OUTPUT_H_INCLUDED
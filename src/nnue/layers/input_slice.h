@@ -25,6 +25,8 @@
 
 namespace Eval::NNUE::Layers {
 
+NNUE_TARGET_BEGIN
+
 // Input layer
 template <IndexType OutputDimensions, IndexType Offset = 0>
 class InputSlice {
@@ -53,6 +55,11 @@ class InputSlice {
     return true;
   }
 
+  // Check network parameters
+  bool VerifyParameters() const {
+    return true;
+  }
+
   // Forward propagation
   const OutputType* Propagate(
       const TransformedFeatureType* transformed_features,
@@ -60,9 +67,18 @@ class InputSlice {
     return transformed_features + Offset;
   }
 
+  // Forward propagation of a batch of positions, see AffineTransform
+  const OutputType* Propagate(
+      const TransformedFeatureType* transformed_features,
+      char* /*buffer*/, IndexType /*count*/, std::size_t /*stride*/) const {
+    return transformed_features + Offset;
+  }
+
  private:
 };
 
+NNUE_TARGET_END
+
 }  // namespace Layers
 
 #endif // #ifndef NNUE_LAYERS_INPUT_SLICE_H_INCLUDED
@@ -0,0 +1,176 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Int8 dot product kernels used by the layers of NNUE evaluation function
+
+#ifndef NNUE_LAYERS_SIMD_H_INCLUDED
+#define NNUE_LAYERS_SIMD_H_INCLUDED
+
+#include "../nnue_common.h"
+
+// The dpbusd kernels multiply groups of 4 unsigned 8-bit inputs by 4 signed
+// 8-bit weights and add the sums to 32-bit accumulators. With VNNI this is a
+// single instruction, either with the AVX512 encoding or, for 256 and 128-bit
+// vectors, with the VEX encoding of AVX-VNNI. Without VNNI the products are
+// summed through 16-bit lanes, so that the x4 variants can saturate: this is
+// why the weights that could overflow are split out when reading the network.
+
+namespace Eval::NNUE::Simd {
+
+#if defined (USE_AVX512)
+
+  [[maybe_unused]] static int m512_hadd(__m512i sum, int bias) {
+    return _mm512_reduce_add_epi32(sum) + bias;
+  }
+
+  [[maybe_unused]] static void m512_add_dpbusd_epi32(__m512i& acc, __m512i a, __m512i b) {
+#if defined (USE_VNNI)
+    acc = _mm512_dpbusd_epi32(acc, a, b);
+#else
+    __m512i product0 = _mm512_maddubs_epi16(a, b);
+    product0 = _mm512_madd_epi16(product0, _mm512_set1_epi16(1));
+    acc = _mm512_add_epi32(acc, product0);
+#endif
+  }
+
+  [[maybe_unused]] static void m512_add_dpbusd_epi32x4(__m512i& acc, __m512i a0, __m512i b0, __m512i a1, __m512i b1,
+                                                                     __m512i a2, __m512i b2, __m512i a3, __m512i b3) {
+#if defined (USE_VNNI)
+    acc = _mm512_dpbusd_epi32(acc, a0, b0);
+    acc = _mm512_dpbusd_epi32(acc, a1, b1);
+    acc = _mm512_dpbusd_epi32(acc, a2, b2);
+    acc = _mm512_dpbusd_epi32(acc, a3, b3);
+#else
+    __m512i product0 = _mm512_maddubs_epi16(a0, b0);
+    __m512i product1 = _mm512_maddubs_epi16(a1, b1);
+    __m512i product2 = _mm512_maddubs_epi16(a2, b2);
+    __m512i product3 = _mm512_maddubs_epi16(a3, b3);
+    product0 = _mm512_add_epi16(product0, product1);
+    product2 = _mm512_add_epi16(product2, product3);
+    product0 = _mm512_add_epi16(product0, product2);
+    product0 = _mm512_madd_epi16(product0, _mm512_set1_epi16(1));
+    acc = _mm512_add_epi32(acc, product0);
+#endif
+  }
+
+#endif
+
+#if defined (USE_AVX2)
+
+  [[maybe_unused]] static int m256_hadd(__m256i sum, int bias) {
+    __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_PERM_BADC));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_PERM_CDAB));
+    return _mm_cvtsi128_si32(sum128) + bias;
+  }
+
+#if defined (USE_AVXVNNI)
+  [[maybe_unused]] static __m256i m256_dpbusd_epi32(__m256i acc, __m256i a, __m256i b) {
+    return _mm256_dpbusd_avx_epi32(acc, a, b);
+  }
+#elif defined (USE_VNNI)
+  [[maybe_unused]] static __m256i m256_dpbusd_epi32(__m256i acc, __m256i a, __m256i b) {
+    return _mm256_dpbusd_epi32(acc, a, b);
+  }
+#endif
+
+  [[maybe_unused]] static void m256_add_dpbusd_epi32(__m256i& acc, __m256i a, __m256i b) {
+#if defined (USE_VNNI)
+    acc = m256_dpbusd_epi32(acc, a, b);
+#else
+    __m256i product0 = _mm256_maddubs_epi16(a, b);
+    product0 = _mm256_madd_epi16(product0, _mm256_set1_epi16(1));
+    acc = _mm256_add_epi32(acc, product0);
+#endif
+  }
+
+  [[maybe_unused]] static void m256_add_dpbusd_epi32x4(__m256i& acc, __m256i a0, __m256i b0, __m256i a1, __m256i b1,
+                                                                     __m256i a2, __m256i b2, __m256i a3, __m256i b3) {
+#if defined (USE_VNNI)
+    acc = m256_dpbusd_epi32(acc, a0, b0);
+    acc = m256_dpbusd_epi32(acc, a1, b1);
+    acc = m256_dpbusd_epi32(acc, a2, b2);
+    acc = m256_dpbusd_epi32(acc, a3, b3);
+#else
+    __m256i product0 = _mm256_maddubs_epi16(a0, b0);
+    __m256i product1 = _mm256_maddubs_epi16(a1, b1);
+    __m256i product2 = _mm256_maddubs_epi16(a2, b2);
+    __m256i product3 = _mm256_maddubs_epi16(a3, b3);
+    product0 = _mm256_add_epi16(product0, product1);
+    product2 = _mm256_add_epi16(product2, product3);
+    product0 = _mm256_add_epi16(product0, product2);
+    product0 = _mm256_madd_epi16(product0, _mm256_set1_epi16(1));
+    acc = _mm256_add_epi32(acc, product0);
+#endif
+  }
+
+#endif
+
+#if defined (USE_SSSE3)
+
+  [[maybe_unused]] static int m128_hadd(__m128i sum, int bias) {
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E)); //_MM_PERM_BADC
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1)); //_MM_PERM_CDAB
+    return _mm_cvtsi128_si32(sum) + bias;
+  }
+
+#if defined (USE_AVXVNNI)
+  [[maybe_unused]] static __m128i m128_dpbusd_epi32(__m128i acc, __m128i a, __m128i b) {
+    return _mm_dpbusd_avx_epi32(acc, a, b);
+  }
+#elif defined (USE_VNNI)
+  [[maybe_unused]] static __m128i m128_dpbusd_epi32(__m128i acc, __m128i a, __m128i b) {
+    return _mm_dpbusd_epi32(acc, a, b);
+  }
+#endif
+
+  [[maybe_unused]] static void m128_add_dpbusd_epi32(__m128i& acc, __m128i a, __m128i b) {
+#if defined (USE_VNNI)
+    acc = m128_dpbusd_epi32(acc, a, b);
+#else
+    __m128i product0 = _mm_maddubs_epi16(a, b);
+    product0 = _mm_madd_epi16(product0, _mm_set1_epi16(1));
+    acc = _mm_add_epi32(acc, product0);
+#endif
+  }
+
+  [[maybe_unused]] static void m128_add_dpbusd_epi32x4(__m128i& acc, __m128i a0, __m128i b0, __m128i a1, __m128i b1,
+                                                                     __m128i a2, __m128i b2, __m128i a3, __m128i b3) {
+#if defined (USE_VNNI)
+    acc = m128_dpbusd_epi32(acc, a0, b0);
+    acc = m128_dpbusd_epi32(acc, a1, b1);
+    acc = m128_dpbusd_epi32(acc, a2, b2);
+    acc = m128_dpbusd_epi32(acc, a3, b3);
+#else
+    __m128i product0 = _mm_maddubs_epi16(a0, b0);
+    __m128i product1 = _mm_maddubs_epi16(a1, b1);
+    __m128i product2 = _mm_maddubs_epi16(a2, b2);
+    __m128i product3 = _mm_maddubs_epi16(a3, b3);
+    product0 = _mm_adds_epi16(product0, product1);
+    product2 = _mm_adds_epi16(product2, product3);
+    product0 = _mm_adds_epi16(product0, product2);
+    product0 = _mm_madd_epi16(product0, _mm_set1_epi16(1));
+    acc = _mm_add_epi32(acc, product0);
+#endif
+  }
+
+#endif
+
+}  // namespace Eval::NNUE::Simd
+
+#endif // #ifndef NNUE_LAYERS_SIMD_H_INCLUDED
@@ -21,6 +21,10 @@
 #ifndef NNUE_ACCUMULATOR_H_INCLUDED
 #define NNUE_ACCUMULATOR_H_INCLUDED
 
+#include <algorithm>
+#include <iterator>
+
+#include "../misc.h"
 #include "nnue_architecture.h"
 
 namespace Eval::NNUE {
@@ -35,6 +39,100 @@ namespace Eval::NNUE {
     AccumulatorState state[2];
   };
 
+  // Per-thread cache of the accumulators computed by the last refreshes, one
+  // for each king square and perspective ("Finny tables"). Along with each
+  // accumulator we keep the pieces it was computed for, so that a refresh only
+  // needs the features of the pieces that differ from the cached position.
+  struct AccumulatorCache {
+
+    struct alignas(kCacheLineSize) Entry {
+      std::int16_t accumulation[kTransformedFeatureDimensions];
+      Bitboard byColorBB[COLOR_NB];
+      Bitboard byTypeBB[PIECE_TYPE_NB];
+      bool computed = false;
+    };
+
+    // Invalidate all the entries, as done when a new network is loaded
+    void clear(std::uint32_t netEpoch) {
+      for (auto& entries : entry)
+          for (Entry& e : entries)
+              e.computed = false;
+      epoch = netEpoch;
+    }
+
+    // Reset the counters, as done at the start of a search
+    void clear_stats() {
+      refreshes = hits = 0;
+      std::fill(std::begin(density), std::end(density), 0);
+    }
+
+    Entry entry[SQUARE_NB][COLOR_NB];
+    std::uint32_t epoch = 0;
+    std::uint64_t refreshes = 0, hits = 0;
+
+    // Histogram of the density of the transformed features of the evaluated
+    // positions, in sixteenths of their chunks of 4 features which are not all
+    // zero. It is filled only when densityStats is set, as by "bench ... density".
+    static constexpr int kDensityBuckets = 17;
+    bool densityStats = false;
+    std::uint64_t density[kDensityBuckets] = {};
+  };
+
+  // Per-thread direct-mapped cache of the NNUE evaluations, in front of the
+  // transform and the propagation. The search evaluates again the positions
+  // whose static evaluation was lost with their TT entry, which happens often
+  // when the TT is under heavy replacement pressure. An entry is indexed by
+  // the low bits of the position key and checked with its upper 32 bits.
+  struct EvalCache {
+
+    struct Entry {
+      std::uint32_t key32;
+      std::int32_t value;
+    };
+
+    ~EvalCache() { std_aligned_free(table); }
+
+    bool enabled() const { return table; }
+
+    // Resize to the largest power of two of entries fitting in the given
+    // number of kilobytes. A zero size disables the cache.
+    void resize(std::size_t kbSize) {
+      std_aligned_free(table);
+      count = kbSize ? std::size_t(1) << msb(kbSize * 1024 / sizeof(Entry)) : 0;
+      table = count ? static_cast<Entry*>(std_aligned_alloc(kCacheLineSize, count * sizeof(Entry))) : nullptr;
+      if (count && !table)
+      {
+          std::cerr << "Failed to allocate " << kbSize << "KB for NNUE evaluation cache." << std::endl;
+          exit(EXIT_FAILURE);
+      }
+      clear(epoch);
+    }
+
+    // Invalidate all the entries, as done when a new network is loaded
+    void clear(std::uint32_t netEpoch) {
+      if (table)
+          std::memset(static_cast<void*>(table), 0, count * sizeof(Entry));
+      epoch = netEpoch;
+    }
+
+    // Reset the counters, as done at the start of a search
+    void clear_stats() { hits = misses = 0; }
+
+    // Entry of the key, found is set if it holds the evaluation of the key
+    Entry* probe(Key key, bool& found) {
+      Entry* e = &table[key & (count - 1)];
+      found = e->key32 == std::uint32_t(key >> 32);
+      hits += found;
+      misses += !found;
+      return e;
+    }
+
+    Entry* table = nullptr;
+    std::size_t count = 0;
+    std::uint32_t epoch = 0;
+    std::uint64_t hits = 0, misses = 0;
+  };
+
 }  // namespace Eval::NNUE
 
 #endif // NNUE_ACCUMULATOR_H_INCLUDED
@@ -43,6 +43,18 @@
 #include <arm_neon.h>
 #endif
 
+// In a dispatch build the code that depends on the instruction set is compiled
+// once per target, with NNUE_TARGET defined to the name of the target. Each copy
+// goes to an inline namespace of that name, so that the copies do not collide
+// at link time while the code keeps naming everything as before.
+#if defined(NNUE_TARGET)
+#define NNUE_TARGET_BEGIN inline namespace NNUE_TARGET {
+#define NNUE_TARGET_END }
+#else
+#define NNUE_TARGET_BEGIN
+#define NNUE_TARGET_END
+#endif
+
 namespace Eval::NNUE {
 
   // Version of the evaluation file
@@ -109,6 +121,8 @@ namespace Eval::NNUE {
       return (n + base - 1) / base * base;
   }
 
+  NNUE_TARGET_BEGIN
+
   // read_little_endian() is our utility to read an integer (signed or unsigned, any size)
   // from a stream in little-endian order. We swap the byte order after the read if
   // necessary to return a result with the byte ordering of the compiling machine.
@@ -127,6 +141,8 @@ namespace Eval::NNUE {
       return result;
   }
 
+  NNUE_TARGET_END
+
 }  // namespace Eval::NNUE
 
 #endif // #ifndef NNUE_COMMON_H_INCLUDED
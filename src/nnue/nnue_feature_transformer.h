@@ -29,6 +29,8 @@
 
 namespace Eval::NNUE {
 
+  NNUE_TARGET_BEGIN
+
   // If vector instructions are enabled, we update and refresh the
   // accumulator tile by tile such that each tile fits in the CPU's
   // vector registers.
@@ -40,6 +42,7 @@ namespace Eval::NNUE {
   #define vec_store(a,b) _mm512_store_si512(a,b)
   #define vec_add_16(a,b) _mm512_add_epi16(a,b)
   #define vec_sub_16(a,b) _mm512_sub_epi16(a,b)
+  #define vec_load_8(a) _mm512_cvtepi8_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(a)))
   static constexpr IndexType kNumRegs = 8; // only 8 are needed
 
   #elif USE_AVX2
@@ -48,6 +51,7 @@ namespace Eval::NNUE {
   #define vec_store(a,b) _mm256_store_si256(a,b)
   #define vec_add_16(a,b) _mm256_add_epi16(a,b)
   #define vec_sub_16(a,b) _mm256_sub_epi16(a,b)
+  #define vec_load_8(a) _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(a)))
   static constexpr IndexType kNumRegs = 16;
 
   #elif USE_SSE2
@@ -56,6 +60,12 @@ namespace Eval::NNUE {
   #define vec_store(a,b) *(a)=(b)
   #define vec_add_16(a,b) _mm_add_epi16(a,b)
   #define vec_sub_16(a,b) _mm_sub_epi16(a,b)
+  #ifdef USE_SSE41
+  #define vec_load_8(a) _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a)))
+  #else
+  #define vec_load_8(a) _mm_srai_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a)), \
+                                                         _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a))), 8)
+  #endif
   static constexpr IndexType kNumRegs = Is64Bit ? 16 : 8;
 
   #elif USE_MMX
@@ -64,6 +74,8 @@ namespace Eval::NNUE {
   #define vec_store(a,b) *(a)=(b)
   #define vec_add_16(a,b) _mm_add_pi16(a,b)
   #define vec_sub_16(a,b) _mm_sub_pi16(a,b)
+  #define vec_load_8(a) _mm_srai_pi16(_mm_unpacklo_pi8(_mm_cvtsi32_si64(*reinterpret_cast<const int*>(a)), \
+                                                       _mm_cvtsi32_si64(*reinterpret_cast<const int*>(a))), 8)
   static constexpr IndexType kNumRegs = 8;
 
   #elif USE_NEON
@@ -72,6 +84,7 @@ namespace Eval::NNUE {
   #define vec_store(a,b) *(a)=(b)
   #define vec_add_16(a,b) vaddq_s16(a,b)
   #define vec_sub_16(a,b) vsubq_s16(a,b)
+  #define vec_load_8(a) vmovl_s8(vld1_s8(a))
   static constexpr IndexType kNumRegs = 16;
 
   #else
@@ -114,18 +127,38 @@ namespace Eval::NNUE {
 
       for (std::size_t i = 0; i < kHalfDimensions; ++i)
         biases_[i] = read_little_endian<BiasType>(stream);
+  #if defined(NNUE_FT_INT8)
+      // The 16-bit weights of the file are stored in 8 bits. Only the nets whose
+      // weights all fit, as the default one, are accepted: the evaluation is then
+      // the same as with 16-bit weights.
+      for (std::size_t i = 0; i < kHalfDimensions * kInputDimensions; ++i)
+      {
+        const std::int16_t w = read_little_endian<std::int16_t>(stream);
+        if (w < INT8_MIN || w > INT8_MAX)
+          return false;
+        weights_[i] = WeightType(w);
+      }
+  #else
       for (std::size_t i = 0; i < kHalfDimensions * kInputDimensions; ++i)
         weights_[i] = read_little_endian<WeightType>(stream);
+  #endif
       return !stream.fail();
     }
 
+    // Update the accumulators of both perspectives. The accumulator cache, if
+    // any, is used to speed up their refreshes.
+    void UpdateAccumulators(const Position& pos, AccumulatorCache* cache) const {
+
+      UpdateAccumulator(pos, WHITE, cache);
+      UpdateAccumulator(pos, BLACK, cache);
+    }
+
     // Convert input features
-    void Transform(const Position& pos, OutputType* output) const {
+    void Transform(const Position& pos, OutputType* output, AccumulatorCache* cache) const {
 
-      UpdateAccumulator(pos, WHITE);
-      UpdateAccumulator(pos, BLACK);
+      UpdateAccumulators(pos, cache);
 
-      const auto& accumulation = pos.state()->accumulator.accumulation;
+      const auto& accumulation = pos.state()->accumulator->accumulation;
 
   #if defined(USE_AVX512)
       constexpr IndexType kNumChunks = kHalfDimensions / (kSimdWidth * 2);
@@ -236,7 +269,24 @@ namespace Eval::NNUE {
     }
 
    private:
-    void UpdateAccumulator(const Position& pos, const Color c) const {
+    // Weight at the given offset in the weights
+    int Weight(IndexType offset) const {
+      return weights_[offset];
+    }
+
+  #ifdef VECTOR
+    // Vector k of the weights from the given offset. 8-bit weights are sign
+    // extended to 16 bits.
+    vec_t LoadWeights(IndexType offset, IndexType k) const {
+  #if defined(NNUE_FT_INT8)
+      return vec_load_8(&weights_[offset + k * (sizeof(vec_t) / 2)]);
+  #else
+      return reinterpret_cast<const vec_t*>(&weights_[offset])[k];
+  #endif
+    }
+  #endif
+
+    void UpdateAccumulator(const Position& pos, const Color c, AccumulatorCache* cache) const {
 
   #ifdef VECTOR
       // Gcc-10.2 unnecessarily spills AVX2 registers if this array
@@ -248,7 +298,7 @@ namespace Eval::NNUE {
       // of the estimated gain in terms of features to be added/subtracted.
       StateInfo *st = pos.state(), *next = nullptr;
       int gain = pos.count<ALL_PIECES>() - 2;
-      while (st->accumulator.state[c] == EMPTY)
+      while (st->accumulator->state[c] == EMPTY)
       {
         auto& dp = st->dirtyPiece;
         // The first condition tests whether an incremental update is
@@ -263,7 +313,7 @@ namespace Eval::NNUE {
         st = st->previous;
       }
 
-      if (st->accumulator.state[c] == COMPUTED)
+      if (st->accumulator->state[c] == COMPUTED)
       {
         if (next == nullptr)
           return;
@@ -282,9 +332,26 @@ namespace Eval::NNUE {
           Features::HalfKP<Features::Side::kFriend>::AppendChangedIndices(pos,
               st2->dirtyPiece, c, &removed[1], &added[1]);
 
+        // Over several plies the same feature can be both removed and added,
+        // for instance when a piece moves twice. As the updates commute such
+        // pairs cancel out, and are dropped before the fused update.
+        for (std::size_t i = 0; i < removed[1].size(); )
+        {
+          auto it = std::find(added[1].begin(), added[1].end(), removed[1][i]);
+          if (it == added[1].end())
+          {
+            ++i;
+            continue;
+          }
+          *it = added[1][added[1].size() - 1];
+          added[1].resize(added[1].size() - 1);
+          removed[1][i] = removed[1][removed[1].size() - 1];
+          removed[1].resize(removed[1].size() - 1);
+        }
+
         // Mark the accumulators as computed.
-        next->accumulator.state[c] = COMPUTED;
-        pos.state()->accumulator.state[c] = COMPUTED;
+        next->accumulator->state[c] = COMPUTED;
+        pos.state()->accumulator->state[c] = COMPUTED;
 
         // Now update the accumulators listed in info[], where the last element is a sentinel.
         StateInfo *info[3] =
@@ -294,7 +361,7 @@ namespace Eval::NNUE {
         {
           // Load accumulator
           auto accTile = reinterpret_cast<vec_t*>(
-            &st->accumulator.accumulation[c][0][j * kTileHeight]);
+            &st->accumulator->accumulation[c][0][j * kTileHeight]);
           for (IndexType k = 0; k < kNumRegs; ++k)
             acc[k] = vec_load(&accTile[k]);
 
@@ -304,23 +371,21 @@ namespace Eval::NNUE {
             for (const auto index : removed[i])
             {
               const IndexType offset = kHalfDimensions * index + j * kTileHeight;
-              auto column = reinterpret_cast<const vec_t*>(&weights_[offset]);
               for (IndexType k = 0; k < kNumRegs; ++k)
-                acc[k] = vec_sub_16(acc[k], column[k]);
+                acc[k] = vec_sub_16(acc[k], LoadWeights(offset, k));
             }
 
             // Difference calculation for the activated features
             for (const auto index : added[i])
             {
               const IndexType offset = kHalfDimensions * index + j * kTileHeight;
-              auto column = reinterpret_cast<const vec_t*>(&weights_[offset]);
               for (IndexType k = 0; k < kNumRegs; ++k)
-                acc[k] = vec_add_16(acc[k], column[k]);
+                acc[k] = vec_add_16(acc[k], LoadWeights(offset, k));
             }
 
             // Store accumulator
             accTile = reinterpret_cast<vec_t*>(
-              &info[i]->accumulator.accumulation[c][0][j * kTileHeight]);
+              &info[i]->accumulator->accumulation[c][0][j * kTileHeight]);
             for (IndexType k = 0; k < kNumRegs; ++k)
               vec_store(&accTile[k], acc[k]);
           }
@@ -329,8 +394,8 @@ namespace Eval::NNUE {
   #else
         for (IndexType i = 0; info[i]; ++i)
         {
-          std::memcpy(info[i]->accumulator.accumulation[c][0],
-              st->accumulator.accumulation[c][0],
+          std::memcpy(info[i]->accumulator->accumulation[c][0],
+              st->accumulator->accumulation[c][0],
               kHalfDimensions * sizeof(BiasType));
           st = info[i];
 
@@ -340,7 +405,7 @@ namespace Eval::NNUE {
             const IndexType offset = kHalfDimensions * index;
 
             for (IndexType j = 0; j < kHalfDimensions; ++j)
-              st->accumulator.accumulation[c][0][j] -= weights_[offset + j];
+              st->accumulator->accumulation[c][0][j] -= Weight(offset + j);
           }
 
           // Difference calculation for the activated features
@@ -349,53 +414,108 @@ namespace Eval::NNUE {
             const IndexType offset = kHalfDimensions * index;
 
             for (IndexType j = 0; j < kHalfDimensions; ++j)
-              st->accumulator.accumulation[c][0][j] += weights_[offset + j];
+              st->accumulator->accumulation[c][0][j] += Weight(offset + j);
           }
         }
   #endif
       }
       else
       {
-        // Refresh the accumulator
-        auto& accumulator = pos.state()->accumulator;
+        // Refresh the accumulator. Start from the cached accumulator of the
+        // same king square when it differs by fewer features than there are
+        // active features, otherwise from the biases.
+        auto& accumulator = *pos.state()->accumulator;
         accumulator.state[c] = COMPUTED;
-        Features::IndexList active;
-        Features::HalfKP<Features::Side::kFriend>::AppendActiveIndices(pos, c, &active);
+        Features::IndexList removed, added;
+        const BiasType* base = biases_;
+        BiasType* cached = nullptr;
+
+        if (cache)
+        {
+          auto& entry = cache->entry[pos.square<KING>(c)][c];
+          ++cache->refreshes;
+
+          if (entry.computed)
+            Features::HalfKP<Features::Side::kFriend>::AppendChangedIndices(pos,
+                entry.byColorBB, entry.byTypeBB, c, &removed, &added);
+
+          if (entry.computed && int(removed.size() + added.size()) < pos.count<ALL_PIECES>() - 2)
+          {
+            base = entry.accumulation;
+            ++cache->hits;
+          }
+          else
+            removed.resize(0), added.resize(0);
+
+          cached = entry.accumulation;
+          entry.computed = true;
+          for (Color c2 : { WHITE, BLACK })
+            entry.byColorBB[c2] = pos.pieces(c2);
+          for (PieceType pt = PAWN; pt < KING; ++pt)
+            entry.byTypeBB[pt] = pos.pieces(pt);
+        }
+
+        if (base == biases_)
+          Features::HalfKP<Features::Side::kFriend>::AppendActiveIndices(pos, c, &added);
 
   #ifdef VECTOR
         for (IndexType j = 0; j < kHalfDimensions / kTileHeight; ++j)
         {
-          auto biasesTile = reinterpret_cast<const vec_t*>(
-              &biases_[j * kTileHeight]);
+          auto baseTile = reinterpret_cast<const vec_t*>(
+              &base[j * kTileHeight]);
           for (IndexType k = 0; k < kNumRegs; ++k)
-            acc[k] = biasesTile[k];
+            acc[k] = vec_load(&baseTile[k]);
 
-          for (const auto index : active)
+          for (const auto index : removed)
           {
             const IndexType offset = kHalfDimensions * index + j * kTileHeight;
-            auto column = reinterpret_cast<const vec_t*>(&weights_[offset]);
+            for (unsigned k = 0; k < kNumRegs; ++k)
+              acc[k] = vec_sub_16(acc[k], LoadWeights(offset, k));
+          }
 
+          for (const auto index : added)
+          {
+            const IndexType offset = kHalfDimensions * index + j * kTileHeight;
             for (unsigned k = 0; k < kNumRegs; ++k)
-              acc[k] = vec_add_16(acc[k], column[k]);
+              acc[k] = vec_add_16(acc[k], LoadWeights(offset, k));
           }
 
           auto accTile = reinterpret_cast<vec_t*>(
               &accumulator.accumulation[c][0][j * kTileHeight]);
           for (unsigned k = 0; k < kNumRegs; k++)
             vec_store(&accTile[k], acc[k]);
+
+          if (cached)
+          {
+            accTile = reinterpret_cast<vec_t*>(&cached[j * kTileHeight]);
+            for (unsigned k = 0; k < kNumRegs; k++)
+              vec_store(&accTile[k], acc[k]);
+          }
         }
 
   #else
-        std::memcpy(accumulator.accumulation[c][0], biases_,
+        std::memcpy(accumulator.accumulation[c][0], base,
             kHalfDimensions * sizeof(BiasType));
 
-        for (const auto index : active)
+        for (const auto index : removed)
         {
           const IndexType offset = kHalfDimensions * index;
 
           for (IndexType j = 0; j < kHalfDimensions; ++j)
-            accumulator.accumulation[c][0][j] += weights_[offset + j];
+            accumulator.accumulation[c][0][j] -= Weight(offset + j);
         }
+
+        for (const auto index : added)
+        {
+          const IndexType offset = kHalfDimensions * index;
+
+          for (IndexType j = 0; j < kHalfDimensions; ++j)
+            accumulator.accumulation[c][0][j] += Weight(offset + j);
+        }
+
+        if (cached)
+          std::memcpy(cached, accumulator.accumulation[c][0],
+              kHalfDimensions * sizeof(BiasType));
   #endif
       }
 
@@ -405,13 +525,19 @@ namespace Eval::NNUE {
     }
 
     using BiasType = std::int16_t;
+  #if defined(NNUE_FT_INT8)
+    using WeightType = std::int8_t;
+  #else
     using WeightType = std::int16_t;
+  #endif
 
     alignas(kCacheLineSize) BiasType biases_[kHalfDimensions];
     alignas(kCacheLineSize)
         WeightType weights_[kHalfDimensions * kInputDimensions];
   };
 
+  NNUE_TARGET_END
+
 }  // namespace Eval::NNUE
 
 #endif // #ifndef NNUE_FEATURE_TRANSFORMER_H_INCLUDED
@@ -21,6 +21,7 @@
 #include <cstddef> // For offsetof()
 #include <cstring> // For std::memset, std::memcmp
 #include <iomanip>
+#include <iostream>
 #include <sstream>
 
 #include "bitboard.h"
@@ -77,7 +78,6 @@ std::ostream& operator<<(std::ostream& os, const Position& pos) {
       && !pos.can_castle(ANY_CASTLING))
   {
       StateInfo st;
-      ASSERT_ALIGNED(&st, Eval::NNUE::kCacheLineSize);
 
       Position p;
       p.set(pos.fen(), pos.is_chess960(), &st, pos.this_thread());
@@ -150,11 +150,22 @@ void Position::init() {
 }
 
 
+/// Position destructor frees its own accumulator stack, if any
+
+Position::~Position() {
+
+  std_aligned_free(smallStack);
+}
+
+
 /// Position::set() initializes the position object with the given FEN string.
 /// This function is not very robust - make sure that input FENs are correct,
-/// this is assumed to be the responsibility of the GUI.
+/// this is assumed to be the responsibility of the GUI. The NNUE accumulators
+/// are taken from the given stack of AccumulatorStackSize, as the one of a search
+/// thread, or else from a small stack of the position.
 
-Position& Position::set(const string& fenStr, bool isChess960, StateInfo* si, Thread* th) {
+Position& Position::set(const string& fenStr, bool isChess960, StateInfo* si, Thread* th,
+                        Eval::NNUE::Accumulator* stack) {
 /*
    A FEN string defines a particular position using only the ASCII character set.
 
@@ -195,9 +206,28 @@ Position& Position::set(const string& fenStr, bool isChess960, StateInfo* si, Th
   Square sq = SQ_A8;
   std::istringstream ss(fenStr);
 
-  std::memset(this, 0, sizeof(Position));
+  // The own accumulator stack is kept over the setups of the position
+  Eval::NNUE::Accumulator* small = smallStack;
+
+  std::memset(static_cast<void*>(this), 0, sizeof(Position));
   std::memset(si, 0, sizeof(StateInfo));
   st = si;
+  smallStack = small;
+
+  if (!stack && !smallStack)
+  {
+      smallStack = static_cast<Eval::NNUE::Accumulator*>(
+                   std_aligned_alloc(alignof(Eval::NNUE::Accumulator), SmallStackSize * sizeof(Eval::NNUE::Accumulator)));
+      if (!smallStack)
+      {
+          std::cerr << "Failed to allocate the accumulator stack of the position." << std::endl;
+          exit(EXIT_FAILURE);
+      }
+  }
+
+  accumulators = stack ? stack : smallStack;
+  accumulatorCount = stack ? AccumulatorStackSize : SmallStackSize;
+  st->accumulator = accumulators;
 
   ss >> std::noskipws;
 
@@ -293,8 +323,8 @@ Position& Position::set(const string& fenStr, bool isChess960, StateInfo* si, Th
 
   chess960 = isChess960;
   thisThread = th;
-  st->accumulator.state[WHITE] = Eval::NNUE::INIT;
-  st->accumulator.state[BLACK] = Eval::NNUE::INIT;
+  st->accumulator->state[WHITE] = Eval::NNUE::INIT;
+  st->accumulator->state[BLACK] = Eval::NNUE::INIT;
 
   assert(pos_is_ok());
 
@@ -700,8 +730,9 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   ++st->pliesFromNull;
 
   // Used by NNUE
-  st->accumulator.state[WHITE] = Eval::NNUE::EMPTY;
-  st->accumulator.state[BLACK] = Eval::NNUE::EMPTY;
+  st->accumulator = next_accumulator(st->previous);
+  st->accumulator->state[WHITE] = Eval::NNUE::EMPTY;
+  st->accumulator->state[BLACK] = Eval::NNUE::EMPTY;
   auto& dp = st->dirtyPiece;
   dp.dirty_num = 1;
 
@@ -1001,8 +1032,9 @@ void Position::do_null_move(StateInfo& newSt) {
 
   st->dirtyPiece.dirty_num = 0;
   st->dirtyPiece.piece[0] = NO_PIECE; // Avoid checks in UpdateAccumulator()
-  st->accumulator.state[WHITE] = Eval::NNUE::EMPTY;
-  st->accumulator.state[BLACK] = Eval::NNUE::EMPTY;
+  st->accumulator = next_accumulator(st->previous);
+  st->accumulator->state[WHITE] = Eval::NNUE::EMPTY;
+  st->accumulator->state[BLACK] = Eval::NNUE::EMPTY;
 
   if (st->epSquare != SQ_NONE)
   {
@@ -1011,7 +1043,7 @@ void Position::do_null_move(StateInfo& newSt) {
   }
 
   st->key ^= Zobrist::side;
-  prefetch(TT.first_entry(key()));
+  prefetch(thisThread->tt.first_entry(key()));
 
   ++st->rule50;
   st->pliesFromNull = 0;
@@ -1313,7 +1345,6 @@ bool Position::pos_is_ok() const {
               assert(0 && "pos_is_ok: Bitboards");
 
   StateInfo si = *st;
-  ASSERT_ALIGNED(&si, Eval::NNUE::kCacheLineSize);
 
   set_state(&si);
   if (std::memcmp(&si, st, sizeof(StateInfo)))
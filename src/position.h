@@ -58,7 +58,7 @@ struct StateInfo {
   int        repetition;
 
   // Used by NNUE
-  Eval::NNUE::Accumulator accumulator;
+  Eval::NNUE::Accumulator* accumulator; // In the accumulator stack of the position
   DirtyPiece dirtyPiece;
 };
 
@@ -80,12 +80,22 @@ class Position {
 public:
   static void init();
 
+  // Number of accumulators of the stack of a search thread, enough for the
+  // states of a search, which start from the root state, plus the ones the
+  // updates walk back. The other positions are only played forward and wrap
+  // around a small stack of their own, bigger than the at most 31 states an
+  // update walks back, see FeatureTransformer::UpdateAccumulator().
+  static constexpr int AccumulatorStackSize = MAX_PLY + 10;
+  static constexpr int SmallStackSize = 32;
+
   Position() = default;
+ ~Position();
   Position(const Position&) = delete;
   Position& operator=(const Position&) = delete;
 
   // FEN string input/output
-  Position& set(const std::string& fenStr, bool isChess960, StateInfo* si, Thread* th);
+  Position& set(const std::string& fenStr, bool isChess960, StateInfo* si, Thread* th,
+                Eval::NNUE::Accumulator* stack = nullptr);
   Position& set(const std::string& code, Color c, StateInfo* si);
   const std::string fen() const;
 
@@ -182,6 +192,7 @@ private:
   void put_piece(Piece pc, Square s);
   void remove_piece(Square s);
   void move_piece(Square from, Square to);
+  Eval::NNUE::Accumulator* next_accumulator(const StateInfo* prev) const;
   template<bool Do>
   void do_castling(Color us, Square from, Square& to, Square& rfrom, Square& rto);
 
@@ -198,6 +209,9 @@ private:
   Score psq;
   Thread* thisThread;
   StateInfo* st;
+  Eval::NNUE::Accumulator* accumulators = nullptr; // Stack in use, indexed by ply from the root state
+  int accumulatorCount;
+  Eval::NNUE::Accumulator* smallStack = nullptr;   // Own stack of SmallStackSize, if no stack is given
   bool chess960;
 };
 
@@ -376,6 +390,14 @@ inline Piece Position::captured_piece() const {
   return st->capturedPiece;
 }
 
+/// The accumulator of a new state is the next one of the stack. The stack wraps
+/// around for the positions only played forward, as the one of the game, whose
+/// updates never walk back as far as the stack size.
+
+inline Eval::NNUE::Accumulator* Position::next_accumulator(const StateInfo* prev) const {
+  return prev->accumulator + 1 < accumulators + accumulatorCount ? prev->accumulator + 1 : accumulators;
+}
+
 inline Thread* Position::this_thread() const {
   return thisThread;
 }
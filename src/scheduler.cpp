@@ -0,0 +1,274 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include "misc.h"
+#include "scheduler.h"
+#include "uci.h"
+
+using namespace std;
+
+/// Scheduler constructor creates the workers, with the options of the front
+/// engine except for the number of threads and the hash size. The workers are
+/// bound to the logical processors as the threads of an engine would be.
+
+Scheduler::Scheduler(Engine& front, size_t workerCount, size_t hashMB) {
+
+  vector<int> cpus = WinProcGroup::thread_cpus(front.options["CPU List"]);
+
+  for (size_t i = 0; i < workerCount; ++i)
+  {
+      workers.push_back(make_unique<Engine>());
+      Engine& w = *workers.back();
+
+      if (!cpus.empty())
+          w.options["CPU List"] = to_string(cpus[i % cpus.size()]);
+
+      w.options["Hash"] = to_string(hashMB);
+      UCI::copy(w.options, front.options, { "Threads", "Hash", "CPU List" });
+
+      w.updates.onBestMove = [this, i](Move bestMove, Move ponder) { done(i, bestMove, ponder); };
+      // The game of the worker is read under the lock, as dispatch() and done()
+      // write it. Info strings are sent before the best move, so dispatch(),
+      // which may wait for the end of a search under the lock, never waits
+      // for one of them.
+      w.updates.onInfoString = [this, i](const string& str) {
+          std::lock_guard<std::mutex> lk(mutex);
+          sync_cout << running[i] << " info string " << str << sync_endl;
+      };
+  }
+
+  running.resize(workerCount);
+  dispatcher = std::thread(&Scheduler::dispatch, this);
+}
+
+
+/// Scheduler destructor drops the queued searches, stops the running ones and
+/// waits for the workers to be idle.
+
+Scheduler::~Scheduler() {
+
+  {
+      std::lock_guard<std::mutex> lk(mutex);
+      exit = true;
+      queue.clear();
+  }
+
+  cv.notify_one();
+  dispatcher.join();
+
+  for (auto& w : workers)
+      w->stop(), w->wait_for_search_finished();
+}
+
+
+/// Scheduler::loop() reads the commands of the games, each line starting with
+/// the name of the game it is sent to, followed by one of the UCI commands
+/// "position", "go", "stop" or "ucinewgame", the latter dropping the game.
+/// Lines "isready" and "quit" are for the scheduler itself. Only the best
+/// moves and the info strings are reported, prefixed by the name of the game.
+
+void Scheduler::loop(istream& in) {
+
+  string cmd, name, token;
+
+  while (getline(in, cmd))
+  {
+      istringstream is(cmd);
+
+      name.clear();
+      token.clear();
+      is >> skipws >> name >> token;
+
+      if (name.empty())
+          continue;
+
+      if (name == "quit")
+          break;
+
+      else if (name == "isready")
+          sync_cout << "readyok" << sync_endl;
+
+      else if (token == "position")
+      {
+          std::lock_guard<std::mutex> lk(mutex);
+          position(games[name], is);
+      }
+
+      else if (token == "go")         go(name, is);
+      else if (token == "stop")       stop(name);
+      else if (token == "ucinewgame")
+      {
+          std::lock_guard<std::mutex> lk(mutex);
+          games.erase(name);
+      }
+      else
+          sync_cout << "Unknown command: " << cmd << sync_endl;
+  }
+}
+
+
+/// Scheduler::position() records the position of a game, to be set up on the
+/// worker searching it. The moves are checked only then.
+
+void Scheduler::position(Game& game, istream& is) {
+
+  string token;
+
+  is >> token;
+
+  if (token == "startpos")
+  {
+      game.fen = Engine::StartFEN;
+      is >> token; // Consume "moves" token if any
+  }
+  else if (token == "fen")
+  {
+      game.fen.clear();
+      while (is >> token && token != "moves")
+          game.fen += token + " ";
+  }
+  else
+      return;
+
+  game.moves.clear();
+  while (is >> token)
+      game.moves.push_back(token);
+}
+
+
+/// Scheduler::go() queues the search of a game with the given limits. Pondering,
+/// perft and searchmoves are not supported.
+
+void Scheduler::go(const string& name, istream& is) {
+
+  Job job;
+  string token;
+
+  job.limits.startTime = now(); // As early as possible!
+
+  while (is >> token)
+      if      (token == "wtime")     is >> job.limits.time[WHITE];
+      else if (token == "btime")     is >> job.limits.time[BLACK];
+      else if (token == "winc")      is >> job.limits.inc[WHITE];
+      else if (token == "binc")      is >> job.limits.inc[BLACK];
+      else if (token == "movestogo") is >> job.limits.movestogo;
+      else if (token == "depth")     is >> job.limits.depth;
+      else if (token == "nodes")     is >> job.limits.nodes;
+      else if (token == "movetime")  is >> job.limits.movetime;
+      else if (token == "mate")      is >> job.limits.mate;
+      else if (token == "infinite")  job.limits.infinite = 1;
+
+  {
+      std::lock_guard<std::mutex> lk(mutex);
+
+      const Game& game = games[name];
+      job.game = name;
+      job.fen = game.fen;
+      job.moves = game.moves;
+      queue.push_back(std::move(job));
+  }
+
+  cv.notify_one();
+}
+
+
+/// Scheduler::stop() stops the search of a game. If it is still queued, it is
+/// turned into a depth 1 search, so that a best move is reported anyhow.
+
+void Scheduler::stop(const string& name) {
+
+  std::lock_guard<std::mutex> lk(mutex);
+
+  for (Job& job : queue)
+      if (job.game == name)
+      {
+          TimePoint startTime = job.limits.startTime;
+          job.limits = Search::LimitsType();
+          job.limits.startTime = startTime;
+          job.limits.depth = 1;
+      }
+
+  for (size_t i = 0; i < workers.size(); ++i)
+      if (running[i] == name)
+          workers[i]->stop();
+}
+
+
+/// Scheduler::done() is called by a worker at the end of its search. It reports
+/// the best move and frees the worker for the next queued search.
+
+void Scheduler::done(size_t worker, Move bestMove, Move ponder) {
+
+  {
+      std::lock_guard<std::mutex> lk(mutex);
+
+      bool chess960 = workers[worker]->pos.is_chess960();
+
+      sync_cout << running[worker] << " bestmove " << UCI::move(bestMove, chess960);
+
+      if (ponder != MOVE_NONE)
+          std::cout << " ponder " << UCI::move(ponder, chess960);
+
+      std::cout << sync_endl;
+
+      running[worker].clear();
+  }
+
+  cv.notify_one();
+}
+
+
+/// Scheduler::dispatch() is the loop of the dispatcher thread, which starts the
+/// queued searches in arrival order as soon as a worker is idle.
+
+void Scheduler::dispatch() {
+
+  std::unique_lock<std::mutex> lk(mutex);
+
+  auto idle = [&](size_t i) { return running[i].empty(); };
+  auto anyIdle = [&]() { return std::find(running.begin(), running.end(), "") != running.end(); };
+
+  while (true)
+  {
+      cv.wait(lk, [&]{ return exit || (!queue.empty() && anyIdle()); });
+
+      if (exit)
+          return;
+
+      Job job = std::move(queue.front());
+      queue.pop_front();
+
+      // Prefer the worker which searched the previous move of the game
+      Game& game = games[job.game];
+      size_t w = game.worker;
+
+      if (w >= workers.size() || !idle(w))
+          for (w = 0; !idle(w); ++w) {}
+
+      game.worker = w;
+      running[w] = job.game;
+
+      // Start under the lock, so that a stop() of the game cannot come first
+      workers[w]->set_position(job.fen, job.moves);
+      workers[w]->go(job.limits);
+  }
+}
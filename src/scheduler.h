@@ -0,0 +1,80 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCHEDULER_H_INCLUDED
+#define SCHEDULER_H_INCLUDED
+
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine.h"
+#include "search.h"
+
+/// Scheduler multiplexes the searches of many independent games over a fixed
+/// set of workers, each an engine instance with a single search thread and its
+/// own small hash. Searches are queued in arrival order and their time starts
+/// at arrival, so that the time spent in the queue is charged to the game and
+/// the latency of a move stays within its time control. A game is preferably
+/// sent back to the worker which searched its previous move, whose hash still
+/// holds the entries of that game.
+
+class Scheduler {
+
+  struct Job {
+    std::string game, fen;
+    std::vector<std::string> moves;
+    Search::LimitsType limits;
+  };
+
+  struct Game {
+    std::string fen = Engine::StartFEN;
+    std::vector<std::string> moves;
+    size_t worker = 0;
+  };
+
+public:
+  Scheduler(Engine& front, size_t workerCount, size_t hashMB);
+ ~Scheduler();
+
+  void loop(std::istream& in);
+
+private:
+  void position(Game& game, std::istream& is);
+  void go(const std::string& name, std::istream& is);
+  void stop(const std::string& name);
+  void done(size_t worker, Move bestMove, Move ponder);
+  void dispatch();
+
+  std::vector<std::unique_ptr<Engine>> workers;
+  std::vector<std::string> running; // Game searched by each worker, empty if idle
+  std::deque<Job> queue;
+  std::map<std::string, Game> games;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool exit = false;
+  std::thread dispatcher; // Started last, after the members it uses
+};
+
+#endif // #ifndef SCHEDULER_H_INCLUDED
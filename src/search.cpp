@@ -35,19 +35,6 @@
 #include "uci.h"
 #include "syzygy/tbprobe.h"
 
-namespace Search {
-
-  LimitsType Limits;
-}
-
-namespace Tablebases {
-
-  int Cardinality;
-  bool RootInTB;
-  bool UseRule50;
-  Depth ProbeDepth;
-}
-
 namespace TB = Tablebases;
 
 using std::string;
@@ -67,11 +54,9 @@ namespace {
     return Value(234 * (d - improving));
   }
 
-  // Reductions lookup table, initialized at startup
-  int Reductions[MAX_MOVES]; // [depth or moveNumber]
-
-  Depth reduction(bool i, Depth d, int mn) {
-    int r = Reductions[d] * Reductions[mn];
+  // Reductions lookup table of the thread, initialized by Thread::clear()
+  Depth reduction(const Thread* th, bool i, Depth d, int mn) {
+    int r = th->reductions[d] * th->reductions[mn];
     return (r + 503) / 1024 + (!i && r > 915);
   }
 
@@ -94,25 +79,41 @@ namespace {
     explicit Skill(int l) : level(l) {}
     bool enabled() const { return level < 20; }
     bool time_to_pick(Depth depth) const { return depth == 1 + level; }
-    Move pick_best(size_t multiPV);
+    Move pick_best(const RootMoves& rootMoves, size_t multiPV);
 
     int level;
     Move best = MOVE_NONE;
   };
 
-  // Breadcrumbs are used to mark nodes as being searched by a given thread
-  struct Breadcrumb {
-    std::atomic<Thread*> thread;
-    std::atomic<Key> key;
-  };
-  std::array<Breadcrumb, 1024> breadcrumbs;
+  // Count a probe of the main transposition table, by NUMA node in NUMA mode.
+  // Otherwise the probes are only counted, all on node 0, when asked by bench.
+  void update_tt_stats(Thread* thisThread, Key key, bool hit) {
+    const TranspositionTable& tt = thisThread->tt;
+    if (tt.numa_nodes() > 1)
+        thisThread->ttStats.update(tt.numa_node(key), hit);
+    else if (thisThread->ttStats.enabled)
+        thisThread->ttStats.update(0, hit);
+  }
+
+  // In ABDADA mode moves leading to a node that another thread is searching
+  // are deferred: they are searched after all the other moves of the node,
+  // unless a cutoff has already made them useless.
+  constexpr int AbdadaMaxDeferred = 32;
+
+  bool busy_elsewhere(Thread* thisThread, Key key) {
+    const Breadcrumb& b = thisThread->threads.breadcrumb(key);
+    Thread* tmp = b.thread.load(std::memory_order_relaxed);
+    return   tmp != nullptr
+          && tmp != thisThread
+          && b.key.load(std::memory_order_relaxed) == key;
+  }
 
   // ThreadHolding structure keeps track of which thread left breadcrumbs at the given
   // node for potential reductions. A free node will be marked upon entering the moves
   // loop by the constructor, and unmarked upon leaving that loop by the destructor.
   struct ThreadHolding {
     explicit ThreadHolding(Thread* thisThread, Key posKey, int ply) {
-       location = ply < 8 ? &breadcrumbs[posKey & (breadcrumbs.size() - 1)] : nullptr;
+       location = ply < 8 ? &thisThread->threads.breadcrumb(posKey) : nullptr;
        otherThread = false;
        owning = false;
        if (location)
@@ -156,6 +157,7 @@ namespace {
   void update_quiet_stats(const Position& pos, Stack* ss, Move move, int bonus, int depth);
   void update_all_stats(const Position& pos, Stack* ss, Move bestMove, Value bestValue, Value beta, Square prevSq,
                         Move* quietsSearched, int quietCount, Move* capturesSearched, int captureCount, Depth depth);
+  void report_pv(const Position& pos, Depth depth, Value alpha, Value beta);
 
   // perft() is our utility to verify move generation. All the leaf nodes up
   // to the given depth are generated and counted, and the sum is returned.
@@ -163,7 +165,6 @@ namespace {
   uint64_t perft(Position& pos, Depth depth) {
 
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::kCacheLineSize);
 
     uint64_t cnt, nodes = 0;
     const bool leaf = (depth == 2);
@@ -188,100 +189,98 @@ namespace {
 } // namespace
 
 
-/// Search::init() is called at startup to initialize various lookup tables
-
-void Search::init() {
-
-  for (int i = 1; i < MAX_MOVES; ++i)
-      Reductions[i] = int((21.3 + 2 * std::log(Threads.size())) * std::log(i + 0.25 * std::log(i)));
-}
-
-
-/// Search::clear() resets search state to its initial value
-
-void Search::clear() {
-
-  Threads.main()->wait_for_search_finished();
-
-  Time.availableNodes = 0;
-  TT.clear();
-  Threads.clear();
-  Tablebases::init(Options["SyzygyPath"]); // Free mapped files
-}
-
-
 /// MainThread::search() is started when the program receives the UCI 'go'
-/// command. It searches from the root position and outputs the "bestmove".
+/// command. It searches from the root position and reports the best move.
 
 void MainThread::search() {
 
-  if (Limits.perft)
+  if (limits.perft)
   {
-      nodes = perft<true>(rootPos, Limits.perft);
+      nodes = perft<true>(rootPos, limits.perft);
       sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
       return;
   }
 
   Color us = rootPos.side_to_move();
-  Time.init(Limits, us, rootPos.game_ply());
-  TT.new_search();
+  tm.init(limits, us, rootPos.game_ply(), options);
+  tt.new_search();
+
+  timerArmed = false;
+  if (!ponder)
+      arm_timer();
+  threads.abdada = options["SMP Mode"] == "ABDADA";
 
-  Eval::NNUE::verify();
+  Eval::NNUE::verify(options, updates.onInfoString);
 
   if (rootMoves.empty())
   {
       rootMoves.emplace_back(MOVE_NONE);
-      sync_cout << "info depth 0 score "
-                << UCI::value(rootPos.checkers() ? -VALUE_MATE : VALUE_DRAW)
-                << sync_endl;
+      updates.onUpdateNoMoves({ 0, rootPos.checkers() ? -VALUE_MATE : VALUE_DRAW });
   }
   else
   {
-      Threads.start_searching(); // start non-main threads
+      threads.start_searching(); // start non-main threads
       Thread::search();          // main thread start searching
   }
 
   // When we reach the maximum depth, we can arrive here without a raise of
-  // Threads.stop. However, if we are pondering or in an infinite search,
+  // threads.stop. However, if we are pondering or in an infinite search,
   // the UCI protocol states that we shouldn't print the best move before the
   // GUI sends a "stop" or "ponderhit" command. We therefore simply wait here
   // until the GUI sends one of those commands.
 
-  while (!Threads.stop && (ponder || Limits.infinite))
+  while (!threads.stop && (ponder || limits.infinite))
   {} // Busy wait for a stop or a ponder reset
 
   // Stop the threads if not already stopped (also raise the stop if
-  // "ponderhit" just reset Threads.ponder).
-  Threads.stop = true;
+  // "ponderhit" just reset threads.ponder).
+  threads.stop = true;
 
   // Wait until all threads have finished
-  Threads.wait_for_search_finished();
+  threads.wait_for_search_finished();
 
   // When playing in 'nodes as time' mode, subtract the searched nodes from
   // the available ones before exiting.
-  if (Limits.npmsec)
-      Time.availableNodes += Limits.inc[us] - Threads.nodes_searched();
+  if (limits.npmsec)
+      tm.availableNodes += limits.inc[us] - threads.nodes_searched();
 
   Thread* bestThread = this;
 
-  if (   int(Options["MultiPV"]) == 1
-      && !Limits.depth
-      && !(Skill(Options["Skill Level"]).enabled() || int(Options["UCI_LimitStrength"]))
+  if (   int(options["MultiPV"]) == 1
+      && !limits.depth
+      && !(Skill(options["Skill Level"]).enabled() || int(options["UCI_LimitStrength"]))
       && rootMoves[0].pv[0] != MOVE_NONE)
-      bestThread = Threads.get_best_thread();
+      bestThread = threads.get_best_thread();
 
   bestPreviousScore = bestThread->rootMoves[0].score;
 
   // Send again PV info if we have a new best thread
   if (bestThread != this)
-      sync_cout << UCI::pv(bestThread->rootPos, bestThread->completedDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
+      report_pv(bestThread->rootPos, bestThread->completedDepth, -VALUE_INFINITE, VALUE_INFINITE);
 
-  sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
+  // In NUMA mode report how the hash probes were spread over the nodes
+  if (tt.numa_nodes() > 1)
+      for (int n = 0; n < tt.numa_nodes(); ++n)
+          updates.onInfoString(tt.numa_info(threads, n));
 
-  if (bestThread->rootMoves[0].pv.size() > 1 || bestThread->rootMoves[0].extract_ponder_from_tt(rootPos))
-      std::cout << " ponder " << UCI::move(bestThread->rootMoves[0].pv[1], rootPos.is_chess960());
+  RootMove& best = bestThread->rootMoves[0];
+  bool hasPonder = best.pv.size() > 1 || best.extract_ponder_from_tt(tt, rootPos);
 
-  std::cout << sync_endl;
+  // If the search was stopped by the timer, record how late the best move is
+  Timer::Clock::time_point fireTime;
+  if (timerArmed && timer.disarm(fireTime))
+  {
+      auto sent = Timer::Clock::now();
+      auto micros = [](Timer::Clock::duration d) {
+          return int64_t(std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+      };
+
+      tm.timerStops++;
+      tm.stopLatency.add(micros(sent - fireTime));
+      tm.overshoot.add(micros(sent - Timer::Clock::time_point(std::chrono::milliseconds(deadline))));
+  }
+
+  updates.onBestMove(best.pv[0], hasPonder ? best.pv[1] : MOVE_NONE);
 }
 
 
@@ -300,7 +299,7 @@ void Thread::search() {
   Value bestValue, alpha, beta, delta;
   Move  lastBestMove = MOVE_NONE;
   Depth lastBestMoveDepth = 0;
-  MainThread* mainThread = (this == Threads.main() ? Threads.main() : nullptr);
+  MainThread* mainThread = (this == threads.main() ? threads.main() : nullptr);
   double timeReduction = 1, totBestMoveChanges = 0;
   Color us = rootPos.side_to_move();
   int iterIdx = 0;
@@ -327,7 +326,7 @@ void Thread::search() {
   std::copy(&lowPlyHistory[2][0], &lowPlyHistory.back().back() + 1, &lowPlyHistory[0][0]);
   std::fill(&lowPlyHistory[MAX_LPH - 2][0], &lowPlyHistory.back().back() + 1, 0);
 
-  size_t multiPV = size_t(Options["MultiPV"]);
+  size_t multiPV = size_t(options["MultiPV"]);
 
   // Pick integer skill levels, but non-deterministically round up or down
   // such that the average integer skill corresponds to the input floating point one.
@@ -335,9 +334,9 @@ void Thread::search() {
   // to CCRL Elo (goldfish 1.13 = 2000) and a fit through Ordo derived Elo
   // for match (TC 60+0.6) results spanning a wide range of k values.
   PRNG rng(now());
-  double floatLevel = Options["UCI_LimitStrength"] ?
-                      std::clamp(std::pow((Options["UCI_Elo"] - 1346.6) / 143.4, 1 / 0.806), 0.0, 20.0) :
-                        double(Options["Skill Level"]);
+  double floatLevel = options["UCI_LimitStrength"] ?
+                      std::clamp(std::pow((options["UCI_Elo"] - 1346.6) / 143.4, 1 / 0.806), 0.0, 20.0) :
+                        double(options["Skill Level"]);
   int intLevel = int(floatLevel) +
                  ((floatLevel - int(floatLevel)) * 1024 > rng.rand<unsigned>() % 1024  ? 1 : 0);
   Skill skill(intLevel);
@@ -350,14 +349,14 @@ void Thread::search() {
   multiPV = std::min(multiPV, rootMoves.size());
   ttHitAverage = TtHitAverageWindow * TtHitAverageResolution / 2;
 
-  int ct = int(Options["Contempt"]) * PawnValueEg / 100; // From centipawns
+  int ct = int(options["Contempt"]) * PawnValueEg / 100; // From centipawns
 
   // In analysis mode, adjust contempt in accordance with user preference
-  if (Limits.infinite || Options["UCI_AnalyseMode"])
-      ct =  Options["Analysis Contempt"] == "Off"  ? 0
-          : Options["Analysis Contempt"] == "Both" ? ct
-          : Options["Analysis Contempt"] == "White" && us == BLACK ? -ct
-          : Options["Analysis Contempt"] == "Black" && us == WHITE ? -ct
+  if (limits.infinite || options["UCI_AnalyseMode"])
+      ct =  options["Analysis Contempt"] == "Off"  ? 0
+          : options["Analysis Contempt"] == "Both" ? ct
+          : options["Analysis Contempt"] == "White" && us == BLACK ? -ct
+          : options["Analysis Contempt"] == "Black" && us == WHITE ? -ct
           : ct;
 
   // Evaluation score is from the white point of view
@@ -368,8 +367,8 @@ void Thread::search() {
 
   // Iterative deepening loop until requested to stop or the target depth is reached
   while (   ++rootDepth < MAX_PLY
-         && !Threads.stop
-         && !(Limits.depth && mainThread && rootDepth > Limits.depth))
+         && !threads.stop
+         && !(limits.depth && mainThread && rootDepth > limits.depth))
   {
       // Age out PV variability metric
       if (mainThread)
@@ -383,11 +382,11 @@ void Thread::search() {
       size_t pvFirst = 0;
       pvLast = 0;
 
-      if (!Threads.increaseDepth)
+      if (!threads.increaseDepth)
          searchAgainCounter++;
 
       // MultiPV loop. We perform a full root search for each PV line
-      for (pvIdx = 0; pvIdx < multiPV && !Threads.stop; ++pvIdx)
+      for (pvIdx = 0; pvIdx < multiPV && !threads.stop; ++pvIdx)
       {
           if (pvIdx == pvLast)
           {
@@ -435,7 +434,7 @@ void Thread::search() {
               // If search has been stopped, we break immediately. Sorting is
               // safe because RootMoves is still valid, although it refers to
               // the previous iteration.
-              if (Threads.stop)
+              if (threads.stop)
                   break;
 
               // When failing high/low give some update (without cluttering
@@ -443,8 +442,8 @@ void Thread::search() {
               if (   mainThread
                   && multiPV == 1
                   && (bestValue <= alpha || bestValue >= beta)
-                  && Time.elapsed() > 3000)
-                  sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
+                  && mainThread->elapsed() > 3000)
+                  report_pv(rootPos, rootDepth, alpha, beta);
 
               // In case of failing low/high increase aspiration window and
               // re-search, otherwise exit the loop.
@@ -474,11 +473,11 @@ void Thread::search() {
           std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
 
           if (    mainThread
-              && (Threads.stop || pvIdx + 1 == multiPV || Time.elapsed() > 3000))
-              sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
+              && (threads.stop || pvIdx + 1 == multiPV || mainThread->elapsed() > 3000))
+              report_pv(rootPos, rootDepth, alpha, beta);
       }
 
-      if (!Threads.stop)
+      if (!threads.stop)
           completedDepth = rootDepth;
 
       if (rootMoves[0].pv[0] != lastBestMove) {
@@ -487,21 +486,21 @@ void Thread::search() {
       }
 
       // Have we found a "mate in x"?
-      if (   Limits.mate
+      if (   limits.mate
           && bestValue >= VALUE_MATE_IN_MAX_PLY
-          && VALUE_MATE - bestValue <= 2 * Limits.mate)
-          Threads.stop = true;
+          && VALUE_MATE - bestValue <= 2 * limits.mate)
+          threads.stop = true;
 
       if (!mainThread)
           continue;
 
       // If skill level is enabled and time is up, pick a sub-optimal best move
       if (skill.enabled() && skill.time_to_pick(rootDepth))
-          skill.pick_best(multiPV);
+          skill.pick_best(rootMoves, multiPV);
 
       // Do we have time for the next iteration? Can we stop searching now?
-      if (    Limits.use_time_management()
-          && !Threads.stop
+      if (    limits.use_time_management()
+          && !threads.stop
           && !mainThread->stopOnPonderhit)
       {
           double fallingEval = (318 + 6 * (mainThread->bestPreviousScore - bestValue)
@@ -513,14 +512,14 @@ void Thread::search() {
           double reduction = (1.47 + mainThread->previousTimeReduction) / (2.32 * timeReduction);
 
           // Use part of the gained time from a previous stable move for the current move
-          for (Thread* th : Threads)
+          for (Thread* th : threads)
           {
               totBestMoveChanges += th->bestMoveChanges;
               th->bestMoveChanges = 0;
           }
-          double bestMoveInstability = 1 + 2 * totBestMoveChanges / Threads.size();
+          double bestMoveInstability = 1 + 2 * totBestMoveChanges / threads.size();
 
-          double totalTime = Time.optimum() * fallingEval * reduction * bestMoveInstability;
+          double totalTime = mainThread->tm.optimum() * fallingEval * reduction * bestMoveInstability;
 
           // Cap used time in case of a single legal move for a better viewer experience in tournaments
           // yielding correct scores and sufficiently fast moves.
@@ -528,21 +527,21 @@ void Thread::search() {
               totalTime = std::min(500.0, totalTime);
 
           // Stop the search if we have exceeded the totalTime
-          if (Time.elapsed() > totalTime)
+          if (mainThread->elapsed() > totalTime)
           {
               // If we are allowed to ponder do not stop the search now but
               // keep pondering until the GUI sends "ponderhit" or "stop".
               if (mainThread->ponder)
                   mainThread->stopOnPonderhit = true;
               else
-                  Threads.stop = true;
+                  threads.stop = true;
           }
-          else if (   Threads.increaseDepth
+          else if (   threads.increaseDepth
                    && !mainThread->ponder
-                   && Time.elapsed() > totalTime * 0.58)
-                   Threads.increaseDepth = false;
+                   && mainThread->elapsed() > totalTime * 0.58)
+                   threads.increaseDepth = false;
           else
-                   Threads.increaseDepth = true;
+                   threads.increaseDepth = true;
       }
 
       mainThread->iterValue[iterIdx] = bestValue;
@@ -557,7 +556,7 @@ void Thread::search() {
   // If skill level is enabled, swap best PV line with the sub-optimal one
   if (skill.enabled())
       std::swap(rootMoves[0], *std::find(rootMoves.begin(), rootMoves.end(),
-                skill.best ? skill.best : skill.pick_best(multiPV)));
+                skill.best ? skill.best : skill.pick_best(rootMoves, multiPV)));
 }
 
 
@@ -595,7 +594,6 @@ namespace {
 
     Move pv[MAX_PLY+1], capturesSearched[32], quietsSearched[64];
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::kCacheLineSize);
 
     TTEntry* tte;
     Key posKey;
@@ -618,7 +616,7 @@ namespace {
     maxValue = VALUE_INFINITE;
 
     // Check for the available remaining time
-    if (thisThread == Threads.main())
+    if (thisThread == thisThread->threads.main())
         static_cast<MainThread*>(thisThread)->check_time();
 
     // Used to send selDepth info to GUI (selDepth counts from 1, ply from 0)
@@ -628,7 +626,7 @@ namespace {
     if (!rootNode)
     {
         // Step 2. Check for aborted search and immediate draw
-        if (   Threads.stop.load(std::memory_order_relaxed)
+        if (   thisThread->threads.stop.load(std::memory_order_relaxed)
             || pos.is_draw(ss->ply)
             || ss->ply >= MAX_PLY)
             return (ss->ply >= MAX_PLY && !ss->inCheck) ? evaluate(pos)
@@ -667,7 +665,8 @@ namespace {
     // position key in case of an excluded move.
     excludedMove = ss->excludedMove;
     posKey = excludedMove == MOVE_NONE ? pos.key() : pos.key() ^ make_key(excludedMove);
-    tte = TT.probe(posKey, ss->ttHit);
+    tte = thisThread->tt.probe(posKey, ss->ttHit);
+    update_tt_stats(thisThread, posKey, ss->ttHit);
     ttValue = ss->ttHit ? value_from_tt(tte->value(), ss->ply, pos.rule50_count()) : VALUE_NONE;
     ttMove =  rootNode ? thisThread->rootMoves[thisThread->pvIdx].pv[0]
             : ss->ttHit    ? tte->move() : MOVE_NONE;
@@ -724,12 +723,12 @@ namespace {
     }
 
     // Step 5. Tablebases probe
-    if (!rootNode && TB::Cardinality)
+    if (!rootNode && thisThread->tbConfig.cardinality)
     {
         int piecesCount = pos.count<ALL_PIECES>();
 
-        if (    piecesCount <= TB::Cardinality
-            && (piecesCount <  TB::Cardinality || depth >= TB::ProbeDepth)
+        if (    piecesCount <= thisThread->tbConfig.cardinality
+            && (piecesCount <  thisThread->tbConfig.cardinality || depth >= thisThread->tbConfig.probeDepth)
             &&  pos.rule50_count() == 0
             && !pos.can_castle(ANY_CASTLING))
         {
@@ -737,14 +736,14 @@ namespace {
             TB::WDLScore wdl = Tablebases::probe_wdl(pos, &err);
 
             // Force check of time on the next occasion
-            if (thisThread == Threads.main())
+            if (thisThread == thisThread->threads.main())
                 static_cast<MainThread*>(thisThread)->callsCnt = 0;
 
             if (err != TB::ProbeState::FAIL)
             {
                 thisThread->tbHits.fetch_add(1, std::memory_order_relaxed);
 
-                int drawScore = TB::UseRule50 ? 1 : 0;
+                int drawScore = thisThread->tbConfig.useRule50 ? 1 : 0;
 
                 // use the range VALUE_MATE_IN_MAX_PLY to VALUE_TB_WIN_IN_MAX_PLY to score
                 value =  wdl < -drawScore ? VALUE_MATED_IN_MAX_PLY + ss->ply + 1
@@ -759,7 +758,7 @@ namespace {
                 {
                     tte->save(posKey, value_to_tt(value, ss->ply), ss->ttPv, b,
                               std::min(MAX_PLY - 1, depth + 6),
-                              MOVE_NONE, VALUE_NONE);
+                              MOVE_NONE, VALUE_NONE, thisThread->tt.generation());
 
                     return value;
                 }
@@ -811,7 +810,7 @@ namespace {
             ss->staticEval = eval = -(ss-1)->staticEval + 2 * Tempo;
 
         // Save static evaluation into transposition table
-        tte->save(posKey, VALUE_NONE, ss->ttPv, BOUND_NONE, DEPTH_NONE, MOVE_NONE, eval);
+        tte->save(posKey, VALUE_NONE, ss->ttPv, BOUND_NONE, DEPTH_NONE, MOVE_NONE, eval, thisThread->tt.generation());
     }
 
     // Use static evaluation difference to improve quiet move ordering
@@ -954,7 +953,7 @@ namespace {
                        && ttValue != VALUE_NONE))
                         tte->save(posKey, value_to_tt(value, ss->ply), ttPv,
                             BOUND_LOWER,
-                            depth - 3, move, ss->staticEval);
+                            depth - 3, move, ss->staticEval, thisThread->tt.generation());
                     return value;
                 }
             }
@@ -990,9 +989,21 @@ moves_loop: // When in check, search starts from here
     // Mark this node as being searched
     ThreadHolding th(thisThread, posKey, ss->ply);
 
+    // Moves deferred in ABDADA mode are returned once the move picker is exhausted
+    Move deferred[AbdadaMaxDeferred];
+    int deferredCount = 0, deferredIdx = 0;
+    bool pickerDone = false;
+
+    auto next_move = [&]() {
+      if (!pickerDone && (move = mp.next_move(moveCountPruning)) != MOVE_NONE)
+          return move;
+      pickerDone = true;
+      return deferredIdx < deferredCount ? deferred[deferredIdx++] : MOVE_NONE;
+    };
+
     // Step 11. Loop through all pseudo-legal moves until no moves remain
     // or a beta cutoff occurs.
-    while ((move = mp.next_move(moveCountPruning)) != MOVE_NONE)
+    while ((move = next_move()) != MOVE_NONE)
     {
       assert(is_ok(move));
 
@@ -1011,12 +1022,24 @@ moves_loop: // When in check, search starts from here
       if (!rootNode && !pos.legal(move))
           continue;
 
+      // Young brothers wait: in ABDADA mode, once the first move is searched,
+      // postpone moves whose subtree is currently being searched by another thread.
+      if (   thisThread->threads.abdada
+          && !pickerDone
+          && moveCount
+          && depth > 1
+          && ss->ply < 7
+          && deferredCount < AbdadaMaxDeferred
+          && busy_elsewhere(thisThread, pos.key_after(move)))
+      {
+          deferred[deferredCount++] = move;
+          continue;
+      }
+
       ss->moveCount = ++moveCount;
 
-      if (rootNode && thisThread == Threads.main() && Time.elapsed() > 3000)
-          sync_cout << "info depth " << depth
-                    << " currmove " << UCI::move(move, pos.is_chess960())
-                    << " currmovenumber " << moveCount + thisThread->pvIdx << sync_endl;
+      if (rootNode && thisThread == thisThread->threads.main() && thisThread->threads.main()->elapsed() > 3000)
+          thisThread->updates.onIter({ depth, move, moveCount + thisThread->pvIdx });
       if (PvNode)
           (ss+1)->pv = nullptr;
 
@@ -1045,7 +1068,7 @@ moves_loop: // When in check, search starts from here
           moveCountPruning = moveCount >= futility_move_count(improving, depth);
 
           // Reduced depth of the next LMR search
-          int lmrDepth = std::max(newDepth - reduction(improving, depth, moveCount), 0);
+          int lmrDepth = std::max(newDepth - reduction(thisThread, improving, depth, moveCount), 0);
 
           if (   captureOrPromotion
               || givesCheck)
@@ -1147,7 +1170,7 @@ moves_loop: // When in check, search starts from here
       newDepth += extension;
 
       // Speculative prefetch as early as possible
-      prefetch(TT.first_entry(pos.key_after(move)));
+      prefetch(thisThread->tt.first_entry(pos.key_after(move)));
 
       // Update the current move (this must be done after singular extension search)
       ss->currentMove = move;
@@ -1170,7 +1193,7 @@ moves_loop: // When in check, search starts from here
               || (!PvNode && !formerPv && captureHistory[movedPiece][to_sq(move)][type_of(pos.captured_piece())] < 4506)
               || thisThread->ttHitAverage < 432 * TtHitAverageResolution * TtHitAverageWindow / 1024))
       {
-          Depth r = reduction(improving, depth, moveCount);
+          Depth r = reduction(thisThread, improving, depth, moveCount);
 
           // Decrease reduction if the ttHit running average is large
           if (thisThread->ttHitAverage > 537 * TtHitAverageResolution * TtHitAverageWindow / 1024)
@@ -1302,7 +1325,7 @@ moves_loop: // When in check, search starts from here
       // Finished searching the move. If a stop occurred, the return value of
       // the search cannot be trusted, and we return immediately without
       // updating best move, PV and TT.
-      if (Threads.stop.load(std::memory_order_relaxed))
+      if (thisThread->threads.stop.load(std::memory_order_relaxed))
           return VALUE_ZERO;
 
       if (rootNode)
@@ -1371,7 +1394,7 @@ moves_loop: // When in check, search starts from here
     // completed. But in this case bestValue is valid because we have fully
     // searched our subtree, and we can anyhow save the result in TT.
     /*
-       if (Threads.stop)
+       if (thisThread->threads.stop)
         return VALUE_DRAW;
     */
 
@@ -1413,7 +1436,7 @@ moves_loop: // When in check, search starts from here
         tte->save(posKey, value_to_tt(bestValue, ss->ply), ss->ttPv,
                   bestValue >= beta ? BOUND_LOWER :
                   PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER,
-                  depth, bestMove, ss->staticEval);
+                  depth, bestMove, ss->staticEval, thisThread->tt.generation());
 
     assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
@@ -1434,7 +1457,6 @@ moves_loop: // When in check, search starts from here
 
     Move pv[MAX_PLY+1];
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::kCacheLineSize);
 
     TTEntry* tte;
     Key posKey;
@@ -1469,9 +1491,30 @@ moves_loop: // When in check, search starts from here
     // only two types of depth in TT: DEPTH_QS_CHECKS or DEPTH_QS_NO_CHECKS.
     ttDepth = ss->inCheck || depth >= DEPTH_QS_CHECKS ? DEPTH_QS_CHECKS
                                                   : DEPTH_QS_NO_CHECKS;
-    // Transposition table lookup
+    // Transposition table lookup, in the hot table of the thread if any. On
+    // a miss there the entry of the main table, if found, is copied in it.
     posKey = pos.key();
-    tte = TT.probe(posKey, ss->ttHit);
+    if (thisThread->hotTT.enabled())
+    {
+        tte = thisThread->hotTT.probe(posKey, ss->ttHit, thisThread->tt.generation());
+        if (thisThread->ttStats.enabled)
+            thisThread->ttStats.update_hot(ss->ttHit);
+
+        if (!ss->ttHit)
+        {
+            TTEntry* deepTte = thisThread->tt.probe(posKey, ss->ttHit);
+            update_tt_stats(thisThread, posKey, ss->ttHit);
+
+            if (ss->ttHit)
+                *tte = *deepTte;
+        }
+    }
+    else
+    {
+        tte = thisThread->tt.probe(posKey, ss->ttHit);
+        update_tt_stats(thisThread, posKey, ss->ttHit);
+    }
+
     ttValue = ss->ttHit ? value_from_tt(tte->value(), ss->ply, pos.rule50_count()) : VALUE_NONE;
     ttMove = ss->ttHit ? tte->move() : MOVE_NONE;
     pvHit = ss->ttHit && tte->is_pv();
@@ -1516,7 +1559,7 @@ moves_loop: // When in check, search starts from here
             // Save gathered info in transposition table
             if (!ss->ttHit)
                 tte->save(posKey, value_to_tt(bestValue, ss->ply), false, BOUND_LOWER,
-                          DEPTH_NONE, MOVE_NONE, ss->staticEval);
+                          DEPTH_NONE, MOVE_NONE, ss->staticEval, thisThread->tt.generation());
 
             return bestValue;
         }
@@ -1583,7 +1626,7 @@ moves_loop: // When in check, search starts from here
           continue;
 
       // Speculative prefetch as early as possible
-      prefetch(TT.first_entry(pos.key_after(move)));
+      prefetch(thisThread->tt.first_entry(pos.key_after(move)));
 
       // Check for legality just before making the move
       if (!pos.legal(move))
@@ -1645,7 +1688,7 @@ moves_loop: // When in check, search starts from here
     tte->save(posKey, value_to_tt(bestValue, ss->ply), pvHit,
               bestValue >= beta ? BOUND_LOWER :
               PvNode && bestValue > oldAlpha  ? BOUND_EXACT : BOUND_UPPER,
-              ttDepth, bestMove, ss->staticEval);
+              ttDepth, bestMove, ss->staticEval, thisThread->tt.generation());
 
     assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
@@ -1806,9 +1849,8 @@ moves_loop: // When in check, search starts from here
   // When playing with strength handicap, choose best move among a set of RootMoves
   // using a statistical rule dependent on 'level'. Idea by Heinz van Saanen.
 
-  Move Skill::pick_best(size_t multiPV) {
+  Move Skill::pick_best(const RootMoves& rootMoves, size_t multiPV) {
 
-    const RootMoves& rootMoves = Threads.main()->rootMoves;
     static PRNG rng(now()); // PRNG sequence should be non-deterministic
 
     // RootMoves are already sorted by score in descending order
@@ -1848,12 +1890,10 @@ void MainThread::check_time() {
       return;
 
   // When using nodes, ensure checking rate is not lower than 0.1% of nodes
-  callsCnt = Limits.nodes ? std::min(1024, int(Limits.nodes / 1024)) : 1024;
+  callsCnt = limits.nodes ? std::min(1024, int(limits.nodes / 1024)) : 1024;
 
-  static TimePoint lastInfoTime = now();
-
-  TimePoint elapsed = Time.elapsed();
-  TimePoint tick = Limits.startTime + elapsed;
+  TimePoint elapsed = this->elapsed();
+  TimePoint tick = limits.startTime + elapsed;
 
   if (tick - lastInfoTime >= 1000)
   {
@@ -1865,73 +1905,107 @@ void MainThread::check_time() {
   if (ponder)
       return;
 
-  if (   (Limits.use_time_management() && (elapsed > Time.maximum() - 10 || stopOnPonderhit))
-      || (Limits.movetime && elapsed >= Limits.movetime)
-      || (Limits.nodes && Threads.nodes_searched() >= (uint64_t)Limits.nodes))
-      Threads.stop = true;
+  // After a ponderhit the timer takes over from here
+  if (!timerArmed)
+      arm_timer();
+
+  if (   (limits.use_time_management() && (elapsed > tm.maximum() - 10 || stopOnPonderhit))
+      || (limits.movetime && elapsed >= limits.movetime)
+      || (limits.nodes && threads.nodes_searched() >= (uint64_t)limits.nodes))
+      threads.stop = true;
 }
 
 
-/// UCI::pv() formats PV information according to the UCI protocol. UCI requires
-/// that all (if any) unsearched PV lines are sent using a previous search score.
+/// MainThread::arm_timer() sets the timer to raise the stop at the time when
+/// check_time() would do it, so that the search stops right then. check_time()
+/// remains as a backup. There is no timer in 'nodes as time' mode.
 
-string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
+void MainThread::arm_timer() {
 
-  std::stringstream ss;
-  TimePoint elapsed = Time.elapsed() + 1;
-  const RootMoves& rootMoves = pos.this_thread()->rootMoves;
-  size_t pvIdx = pos.this_thread()->pvIdx;
-  size_t multiPV = std::min((size_t)Options["MultiPV"], rootMoves.size());
-  uint64_t nodesSearched = Threads.nodes_searched();
-  uint64_t tbHits = Threads.tb_hits() + (TB::RootInTB ? rootMoves.size() : 0);
+  timerArmed = true;
 
-  for (size_t i = 0; i < multiPV; ++i)
-  {
-      bool updated = rootMoves[i].score != -VALUE_INFINITE;
+  if (limits.npmsec)
+      return;
 
-      if (depth == 1 && !updated && i > 0)
-          continue;
+  if (limits.use_time_management())
+      deadline = stopOnPonderhit ? now() : limits.startTime + tm.maximum() - 10;
+
+  else if (limits.movetime)
+      deadline = limits.startTime + limits.movetime;
+
+  else
+      return;
+
+  // After a ponderhit the deadline may be already past
+  deadline = std::max(deadline, now());
+
+  timer.arm(deadline, [this]() { threads.stop = true; });
+}
 
-      Depth d = updated ? depth : std::max(1, depth - 1);
-      Value v = updated ? rootMoves[i].score : rootMoves[i].previousScore;
 
-      if (v == -VALUE_INFINITE)
-          v = VALUE_ZERO;
+/// MainThread::elapsed() returns the time elapsed since the start of the search,
+/// or the searched nodes when playing in 'nodes as time' mode.
 
-      bool tb = TB::RootInTB && abs(v) < VALUE_MATE_IN_MAX_PLY;
-      v = tb ? rootMoves[i].tbScore : v;
+TimePoint MainThread::elapsed() const {
 
-      if (ss.rdbuf()->in_avail()) // Not at first line
-          ss << "\n";
+  return tm.elapsed([this]() { return threads.nodes_searched(); });
+}
 
-      ss << "info"
-         << " depth "    << d
-         << " seldepth " << rootMoves[i].selDepth
-         << " multipv "  << i + 1
-         << " score "    << UCI::value(v);
 
-      if (Options["UCI_ShowWDL"])
-          ss << UCI::wdl(v, pos.game_ply());
+namespace {
+
+  // report_pv() sends the PV information of the thread of the given position
+  // to the onUpdateFull callback, one call per PV line. UCI requires that all
+  // (if any) unsearched PV lines are sent using a previous search score.
 
-      if (!tb && i == pvIdx)
-          ss << (v >= beta ? " lowerbound" : v <= alpha ? " upperbound" : "");
+  void report_pv(const Position& pos, Depth depth, Value alpha, Value beta) {
+
+    const Thread* thisThread = pos.this_thread();
+    const RootMoves& rootMoves = thisThread->rootMoves;
+    const ThreadPool& threads = thisThread->threads;
+    TimePoint elapsed = threads.main()->elapsed() + 1;
+    size_t pvIdx = thisThread->pvIdx;
+    size_t multiPV = std::min((size_t)thisThread->options["MultiPV"], rootMoves.size());
+    uint64_t nodesSearched = threads.nodes_searched();
+    uint64_t tbHits = threads.tb_hits() + (thisThread->tbConfig.rootInTB ? rootMoves.size() : 0);
+
+    for (size_t i = 0; i < multiPV; ++i)
+    {
+        bool updated = rootMoves[i].score != -VALUE_INFINITE;
 
-      ss << " nodes "    << nodesSearched
-         << " nps "      << nodesSearched * 1000 / elapsed;
+        if (depth == 1 && !updated && i > 0)
+            continue;
 
-      if (elapsed > 1000) // Earlier makes little sense
-          ss << " hashfull " << TT.hashfull();
+        Depth d = updated ? depth : std::max(1, depth - 1);
+        Value v = updated ? rootMoves[i].score : rootMoves[i].previousScore;
 
-      ss << " tbhits "   << tbHits
-         << " time "     << elapsed
-         << " pv";
+        if (v == -VALUE_INFINITE)
+            v = VALUE_ZERO;
 
-      for (Move m : rootMoves[i].pv)
-          ss << " " << UCI::move(m, pos.is_chess960());
+        bool tb = thisThread->tbConfig.rootInTB && abs(v) < VALUE_MATE_IN_MAX_PLY;
+        v = tb ? rootMoves[i].tbScore : v;
+
+        InfoFull info;
+
+        info.depth    = d;
+        info.score    = v;
+        info.selDepth = rootMoves[i].selDepth;
+        info.multiPV  = i + 1;
+        info.bound    = !tb && i == pvIdx && v >= beta  ? BOUND_LOWER
+                      : !tb && i == pvIdx && v <= alpha ? BOUND_UPPER : BOUND_EXACT;
+        info.tbScore  = tb;
+        info.nodes    = nodesSearched;
+        info.nps      = nodesSearched * 1000 / elapsed;
+        info.tbHits   = tbHits;
+        info.time     = elapsed;
+        info.hashfull = elapsed > 1000 ? thisThread->tt.hashfull() : -1; // Earlier makes little sense
+        info.pv       = rootMoves[i].pv;
+
+        thisThread->updates.onUpdateFull(info);
+    }
   }
 
-  return ss.str();
-}
+} // namespace
 
 
 /// RootMove::extract_ponder_from_tt() is called in case we have no ponder move
@@ -1939,10 +2013,9 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
 /// fail high at root. We try hard to have a ponder move to return to the GUI,
 /// otherwise in case of 'ponder on' we have nothing to think on.
 
-bool RootMove::extract_ponder_from_tt(Position& pos) {
+bool RootMove::extract_ponder_from_tt(const TranspositionTable& tt, Position& pos) {
 
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::kCacheLineSize);
 
     bool ttHit;
 
@@ -1952,7 +2025,7 @@ bool RootMove::extract_ponder_from_tt(Position& pos) {
         return false;
 
     pos.do_move(pv[0], st);
-    TTEntry* tte = TT.probe(pos.key(), ttHit);
+    TTEntry* tte = tt.probe(pos.key(), ttHit);
 
     if (ttHit)
     {
@@ -1965,36 +2038,38 @@ bool RootMove::extract_ponder_from_tt(Position& pos) {
     return pv.size() > 1;
 }
 
-void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
+Tablebases::Config Tablebases::rank_root_moves(UCI::OptionsMap& options, Position& pos, Search::RootMoves& rootMoves) {
 
-    RootInTB = false;
-    UseRule50 = bool(Options["Syzygy50MoveRule"]);
-    ProbeDepth = int(Options["SyzygyProbeDepth"]);
-    Cardinality = int(Options["SyzygyProbeLimit"]);
+    Config config;
+
+    config.rootInTB = false;
+    config.useRule50 = bool(options["Syzygy50MoveRule"]);
+    config.probeDepth = int(options["SyzygyProbeDepth"]);
+    config.cardinality = int(options["SyzygyProbeLimit"]);
     bool dtz_available = true;
 
     // Tables with fewer pieces than SyzygyProbeLimit are searched with
-    // ProbeDepth == DEPTH_ZERO
-    if (Cardinality > MaxCardinality)
+    // probeDepth == DEPTH_ZERO
+    if (config.cardinality > MaxCardinality)
     {
-        Cardinality = MaxCardinality;
-        ProbeDepth = 0;
+        config.cardinality = MaxCardinality;
+        config.probeDepth = 0;
     }
 
-    if (Cardinality >= popcount(pos.pieces()) && !pos.can_castle(ANY_CASTLING))
+    if (config.cardinality >= popcount(pos.pieces()) && !pos.can_castle(ANY_CASTLING))
     {
         // Rank moves using DTZ tables
-        RootInTB = root_probe(pos, rootMoves);
+        config.rootInTB = root_probe(pos, rootMoves, config.useRule50);
 
-        if (!RootInTB)
+        if (!config.rootInTB)
         {
             // DTZ tables are missing; try to rank moves using WDL tables
             dtz_available = false;
-            RootInTB = root_probe_wdl(pos, rootMoves);
+            config.rootInTB = root_probe_wdl(pos, rootMoves, config.useRule50);
         }
     }
 
-    if (RootInTB)
+    if (config.rootInTB)
     {
         // Sort moves according to TB rank
         std::stable_sort(rootMoves.begin(), rootMoves.end(),
@@ -2002,7 +2077,7 @@ void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
 
         // Probe during search only if DTZ is not available and we are winning
         if (dtz_available || rootMoves[0].tbScore <= VALUE_DRAW)
-            Cardinality = 0;
+            config.cardinality = 0;
     }
     else
     {
@@ -2010,4 +2085,6 @@ void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
         for (auto& m : rootMoves)
             m.tbRank = 0;
     }
+
+    return config;
 }
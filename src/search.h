@@ -19,13 +19,18 @@
 #ifndef SEARCH_H_INCLUDED
 #define SEARCH_H_INCLUDED
 
+#include <functional>
+#include <string>
 #include <vector>
 
 #include "misc.h"
 #include "movepick.h"
 #include "types.h"
+#include "uci.h"
 
 class Position;
+class TranspositionTable;
+struct ThreadPool;
 
 namespace Search {
 
@@ -60,7 +65,7 @@ struct Stack {
 struct RootMove {
 
   explicit RootMove(Move m) : pv(1, m) {}
-  bool extract_ponder_from_tt(Position& pos);
+  bool extract_ponder_from_tt(const TranspositionTable& tt, Position& pos);
   bool operator==(const Move& m) const { return pv[0] == m; }
   bool operator<(const RootMove& m) const { // Sort in descending order
     return m.score != score ? m.score < score
@@ -99,10 +104,53 @@ struct LimitsType {
   int64_t nodes;
 };
 
-extern LimitsType Limits;
 
-void init();
-void clear();
+/// Info structs carry the reports of a search, sent through the callbacks of
+/// UpdateContext instead of being printed. InfoShort is sent when there are no
+/// legal moves, InfoFull for each PV line and InfoIteration when a root move
+/// is started. A hashfull of -1 means that it was too early to compute it.
+
+struct InfoShort {
+  Depth depth;
+  Value score;
+};
+
+struct InfoFull : InfoShort {
+  int selDepth;
+  size_t multiPV;
+  Bound bound;
+  bool tbScore;
+  uint64_t nodes, nps, tbHits;
+  TimePoint time;
+  int hashfull;
+  std::vector<Move> pv;
+};
+
+struct InfoIteration {
+  Depth depth;
+  Move currmove;
+  size_t currmovenumber;
+};
+
+struct UpdateContext {
+  std::function<void(const InfoShort&)>     onUpdateNoMoves = [](const InfoShort&) {};
+  std::function<void(const InfoFull&)>      onUpdateFull    = [](const InfoFull&) {};
+  std::function<void(const InfoIteration&)> onIter          = [](const InfoIteration&) {};
+  std::function<void(Move, Move)>           onBestMove      = [](Move, Move) {};
+  std::function<void(const std::string&)>   onInfoString    = [](const std::string&) {};
+};
+
+
+/// SharedState struct gathers the state of an engine instance used by all its
+/// search threads: the options, the thread pool itself, the transposition
+/// table and the callbacks receiving the search reports.
+
+struct SharedState {
+  UCI::OptionsMap& options;
+  ThreadPool& threads;
+  TranspositionTable& tt;
+  UpdateContext& updates;
+};
 
 } // namespace Search
 
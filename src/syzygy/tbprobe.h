@@ -43,14 +43,22 @@ enum ProbeState {
     ZEROING_BEST_MOVE =  2  // Best move zeroes DTZ (capture or pawn move)
 };
 
+// Probing parameters of a search, set up when ranking the root moves
+struct Config {
+    int cardinality = 0;
+    bool rootInTB = false;
+    bool useRule50 = true;
+    Depth probeDepth = 0;
+};
+
 extern int MaxCardinality;
 
 void init(const std::string& paths);
 WDLScore probe_wdl(Position& pos, ProbeState* result);
 int probe_dtz(Position& pos, ProbeState* result);
-bool root_probe(Position& pos, Search::RootMoves& rootMoves);
-bool root_probe_wdl(Position& pos, Search::RootMoves& rootMoves);
-void rank_root_moves(Position& pos, Search::RootMoves& rootMoves);
+bool root_probe(Position& pos, Search::RootMoves& rootMoves, bool rule50);
+bool root_probe_wdl(Position& pos, Search::RootMoves& rootMoves, bool rule50);
+Config rank_root_moves(UCI::OptionsMap& options, Position& pos, Search::RootMoves& rootMoves);
 
 inline std::ostream& operator<<(std::ostream& os, const WDLScore v) {
 
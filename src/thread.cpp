@@ -18,7 +18,14 @@
 
 #include <cassert>
 
-#include <algorithm> // For std::count
+#include <algorithm> // For std::count and std::any_of
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#if defined(_MSC_VER)
+#include <intrin.h> // For _mm_pause()
+#endif
+
 #include "movegen.h"
 #include "search.h"
 #include "thread.h"
@@ -26,13 +33,55 @@
 #include "syzygy/tbprobe.h"
 #include "tt.h"
 
-ThreadPool Threads; // Global object
+
+namespace {
+
+  // spin() busy waits until the condition holds, for at most the given number
+  // of microseconds, so that a thread woken up soon after going idle does not
+  // pay the latency of parking on a condition variable. The CPU is told that
+  // we spin, which also leaves more resources to an SMT sibling.
+  template<typename Cond>
+  void spin(int budget, Cond done) {
+
+    if (budget <= 0)
+        return;
+
+    const auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(budget);
+
+    for (int i = 1; !done(); ++i)
+    {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+        if (!(i & 63) && std::chrono::steady_clock::now() > end)
+            return;
+    }
+  }
+
+} // namespace
 
 
 /// Thread constructor launches the thread and waits until it goes to sleep
 /// in idle_loop(). Note that 'searching' and 'exit' should be already set.
 
-Thread::Thread(size_t n) : idx(n), stdThread(&Thread::idle_loop, this) {
+Thread::Thread(Search::SharedState& shared, size_t n)
+  : idx(n), options(shared.options), threads(shared.threads), tt(shared.tt), updates(shared.updates),
+    stdThread(&Thread::idle_loop, this) {
+
+  hotTT.resize(size_t(options["Hot Hash"]));
+  evalCache.resize(size_t(options["Eval Cache"]));
+
+  accumulators = static_cast<Eval::NNUE::Accumulator*>(std_aligned_alloc(
+                 alignof(Eval::NNUE::Accumulator), Position::AccumulatorStackSize * sizeof(Eval::NNUE::Accumulator)));
+  if (!accumulators)
+  {
+      std::cerr << "Failed to allocate the accumulator stack of the thread." << std::endl;
+      std::exit(EXIT_FAILURE);
+  }
 
   wait_for_search_finished();
 }
@@ -48,13 +97,21 @@ Thread::~Thread() {
   exit = true;
   start_searching();
   stdThread.join();
+
+  std_aligned_free(accumulators);
 }
 
 
-/// Thread::clear() reset histories, usually before a new game
+/// Thread::clear() reset histories, usually before a new game, and sets up the
+/// reductions table, which depends on the number of threads.
 
 void Thread::clear() {
 
+  for (int i = 1; i < MAX_MOVES; ++i)
+      reductions[i] = int((21.3 + 2 * std::log(threads.size())) * std::log(i + 0.25 * std::log(i)));
+
+  hotTT.clear();
+  evalCache.clear(evalCache.epoch);
   counterMoves.fill(MOVE_NONE);
   mainHistory.fill(0);
   lowPlyHistory.fill(0);
@@ -77,6 +134,7 @@ void Thread::start_searching() {
 
   std::lock_guard<std::mutex> lk(mutex);
   searching = true;
+  ++generation;
   cv.notify_one(); // Wake up the thread in idle_loop()
 }
 
@@ -86,11 +144,30 @@ void Thread::start_searching() {
 
 void Thread::wait_for_search_finished() {
 
+  spin(threads.idleSpin, [&]{ return !(generation & 1); });
+
   std::unique_lock<std::mutex> lk(mutex);
   cv.wait(lk, [&]{ return !searching; });
 }
 
 
+/// Thread::run_custom_job() wakes up the thread to run the given function
+/// instead of a search, and returns immediately.
+
+void Thread::run_custom_job(std::function<void()> f) {
+
+  {
+      std::unique_lock<std::mutex> lk(mutex);
+      cv.wait(lk, [&]{ return !searching; });
+      jobFunc = std::move(f);
+      searching = true;
+      ++generation;
+  }
+
+  cv.notify_one(); // Wake up the thread in idle_loop()
+}
+
+
 /// Thread::idle_loop() is where the thread is parked, blocked on the
 /// condition variable, when it has no work to do.
 
@@ -100,23 +177,42 @@ void Thread::idle_loop() {
   // the choice, eventually we are one of many one-threaded processes running on
   // some Windows NUMA hardware, for instance in fishtest. To make it simple,
   // just check if running threads are below a threshold, in this case all this
-  // NUMA machinery is not needed.
-  if (Options["Threads"] > 8)
+  // NUMA machinery is not needed. An explicit list of CPUs is always obeyed.
+  if (!threads.cpus.empty())
+      WinProcGroup::bindThisThreadToCpu(threads.cpus[idx % threads.cpus.size()]);
+
+  else if (options["Threads"] > 8)
       WinProcGroup::bindThisThread(idx);
 
   while (true)
   {
       std::unique_lock<std::mutex> lk(mutex);
       searching = false;
+      const uint64_t gen = ++generation;
       cv.notify_one(); // Wake up anyone waiting for search finished
+
+      // Optionally spin for a while before parking, see spin()
+      if (threads.idleSpin > 0)
+      {
+          lk.unlock();
+          spin(threads.idleSpin, [&]{ return generation != gen; });
+          lk.lock();
+      }
+
       cv.wait(lk, [&]{ return searching; });
 
       if (exit)
           return;
 
+      std::function<void()> job = std::move(jobFunc);
+      jobFunc = nullptr;
+
       lk.unlock();
 
-      search();
+      if (job)
+          job();
+      else
+          search();
   }
 }
 
@@ -124,57 +220,95 @@ void Thread::idle_loop() {
 /// Created and launched threads will immediately go to sleep in idle_loop.
 /// Upon resizing, threads are recreated to allow for binding if necessary.
 
-void ThreadPool::set(size_t requested) {
+void ThreadPool::set(Search::SharedState shared, size_t requested) {
 
   if (size() > 0) { // destroy any existing thread(s)
       main()->wait_for_search_finished();
+      wait_for_clear();
 
       while (size() > 0)
           delete back(), pop_back();
   }
 
+  // Choose the logical processors before the threads bind themselves
+  idleSpin = int(shared.options["Idle Spin"]);
+  cpus = WinProcGroup::thread_cpus(shared.options["CPU List"]);
+  groups.clear();
+
+  for (size_t idx = 0; idx < requested; ++idx)
+      groups.push_back(  !cpus.empty()  ? WinProcGroup::cpu_group(cpus[idx % cpus.size()])
+                       : requested > 8  ? WinProcGroup::best_group(idx) : -1);
+
   if (requested > 0) { // create new thread(s)
-      push_back(new MainThread(0));
+      resize(requested);
+
+      auto create = [&](size_t idx) {
+          (*this)[idx] = idx ? new Thread(shared, idx) : new MainThread(shared, 0);
+      };
+
+      // Each thread is allocated and first touched by a helper bound to the node
+      // the thread will run on, so that its memory is local. The histories are
+      // first touched by the thread itself, see clear().
+      if (   shared.options["NUMA Threads"]
+          && std::any_of(groups.begin(), groups.end(), [](int g) { return g >= 0; }))
+      {
+          std::vector<std::thread> helpers;
+
+          for (size_t idx = 0; idx < requested; ++idx)
+              helpers.emplace_back([&, idx]() {
+                  if (groups[idx] >= 0)
+                      WinProcGroup::bindThisThreadToGroup(groups[idx]);
+
+                  create(idx);
+              });
+
+          for (std::thread& th : helpers)
+              th.join();
+      }
+      else
+          for (size_t idx = 0; idx < requested; ++idx)
+              create(idx);
 
-      while (size() < requested)
-          push_back(new Thread(size()));
       clear();
 
       // Reallocate the hash with the new threadpool size
-      TT.resize(size_t(Options["Hash"]));
-
-      // Init thread number dependent search params.
-      Search::init();
+      shared.tt.resize(size_t(shared.options["Hash"]), size(), shared.options["NUMA Hash"], shared.options["Rehash"]);
   }
 }
 
 
-/// ThreadPool::clear() sets threadPool data to initial values
+/// ThreadPool::clear() sets threadPool data to initial values. Each thread
+/// clears its own tables, all in parallel, and the function returns at once:
+/// wait_for_clear() waits for them to be done.
 
 void ThreadPool::clear() {
 
   for (Thread* th : *this)
-      th->clear();
+      th->run_custom_job([th]() { th->clear(); });
+
+  clearing = true;
 
   main()->callsCnt = 0;
   main()->bestPreviousScore = VALUE_INFINITE;
   main()->previousTimeReduction = 1.0;
+  main()->tm.availableNodes = 0;
 }
 
 
 /// ThreadPool::start_thinking() wakes up main thread waiting in idle_loop() and
 /// returns immediately. Main thread will wake up other threads and start the search.
 
-void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
+void ThreadPool::start_thinking(UCI::OptionsMap& options, Position& pos, StateListPtr& states,
                                 const Search::LimitsType& limits, bool ponderMode) {
 
   main()->wait_for_search_finished();
+  wait_for_clear();
 
   main()->stopOnPonderhit = stop = false;
   increaseDepth = true;
   main()->ponder = ponderMode;
-  Search::Limits = limits;
   Search::RootMoves rootMoves;
+  Tablebases::Config tbConfig;
 
   for (const auto& m : MoveList<LEGAL>(pos))
       if (   limits.searchmoves.empty()
@@ -182,7 +316,7 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
           rootMoves.emplace_back(m);
 
   if (!rootMoves.empty())
-      Tablebases::rank_root_moves(pos, rootMoves);
+      tbConfig = Tablebases::rank_root_moves(options, pos, rootMoves);
 
   // After ownership transfer 'states' becomes empty, so if we stop the search
   // and call 'go' again without setting a new position states.get() == NULL.
@@ -199,10 +333,17 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
   for (Thread* th : *this)
   {
       th->nodes = th->tbHits = th->nmpMinPly = th->bestMoveChanges = 0;
+      th->ttStats.clear();
+      th->accumulatorCache.clear_stats();
+      th->evalCache.clear_stats();
       th->rootDepth = th->completedDepth = 0;
+      th->limits = limits;
+      th->tbConfig = tbConfig;
       th->rootMoves = rootMoves;
-      th->rootPos.set(pos.fen(), pos.is_chess960(), &th->rootState, th);
+      th->rootPos.set(pos.fen(), pos.is_chess960(), &th->rootState, th, th->accumulators);
+      Eval::NNUE::Accumulator* acc = th->rootState.accumulator; // Stack of the thread
       th->rootState = setupStates->back();
+      th->rootState.accumulator = acc;
   }
 
   main()->start_searching();
@@ -258,3 +399,19 @@ void ThreadPool::wait_for_search_finished() const {
         if (th != front())
             th->wait_for_search_finished();
 }
+
+
+/// ThreadPool::wait_for_clear() waits for the threads to have cleared their
+/// tables after clear(). Between two clears, it returns at once, even if a
+/// search is running.
+
+void ThreadPool::wait_for_clear() {
+
+  if (!clearing)
+      return;
+
+  for (Thread* th : *this)
+      th->wait_for_search_finished();
+
+  clearing = false;
+}
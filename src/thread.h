@@ -19,8 +19,10 @@
 #ifndef THREAD_H_INCLUDED
 #define THREAD_H_INCLUDED
 
+#include <array>
 #include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -30,13 +32,17 @@
 #include "pawns.h"
 #include "position.h"
 #include "search.h"
+#include "timeman.h"
+#include "tt.h"
 #include "thread_win32_osx.h"
+#include "syzygy/tbprobe.h"
 
 
 /// Thread class keeps together all the thread-related stuff. We use
 /// per-thread pawn and material hash tables so that once we get a
 /// pointer to an entry its life time is unlimited and we don't have
-/// to care about someone changing the entry under our feet.
+/// to care about someone changing the entry under our feet. Each thread keeps
+/// references to the shared state of the engine instance it belongs to.
 
 class Thread {
 
@@ -44,25 +50,40 @@ class Thread {
   std::condition_variable cv;
   size_t idx;
   bool exit = false, searching = true; // Set before starting std::thread
-  NativeThread stdThread;
+  std::function<void()> jobFunc;       // Run by idle_loop() instead of search()
+  std::atomic<uint64_t> generation{1}; // Incremented at each start and end of work, odd while busy
 
 public:
-  explicit Thread(size_t);
+  Thread(Search::SharedState&, size_t);
   virtual ~Thread();
   virtual void search();
   void clear();
   void idle_loop();
   void start_searching();
   void wait_for_search_finished();
+  void run_custom_job(std::function<void()> f);
+
+  UCI::OptionsMap& options;
+  ThreadPool& threads;
+  TranspositionTable& tt;
+  Search::UpdateContext& updates;
 
   Pawns::Table pawnsTable;
   Material::Table materialTable;
+  Search::LimitsType limits;
+  Tablebases::Config tbConfig;
+  int reductions[MAX_MOVES]; // [depth or moveNumber]
   size_t pvIdx, pvLast;
   uint64_t ttHitAverage;
   int selDepth, nmpMinPly;
   Color nmpColor;
   std::atomic<uint64_t> nodes, tbHits, bestMoveChanges;
+  TTStats ttStats;
+  HotTable hotTT;
+  Eval::NNUE::AccumulatorCache accumulatorCache;
+  Eval::NNUE::EvalCache evalCache;
 
+  Eval::NNUE::Accumulator* accumulators; // Stack of the states of the search
   Position rootPos;
   StateInfo rootState;
   Search::RootMoves rootMoves;
@@ -74,6 +95,9 @@ public:
   ContinuationHistory continuationHistory[2][2];
   Score contempt;
   int failedHighCnt;
+
+private:
+  NativeThread stdThread; // Last member, started once the others are built
 };
 
 
@@ -85,13 +109,28 @@ struct MainThread : public Thread {
 
   void search() override;
   void check_time();
+  void arm_timer();
+  TimePoint elapsed() const;
 
+  TimeManagement tm;
   double previousTimeReduction;
   Value bestPreviousScore;
   Value iterValue[4];
   int callsCnt;
   bool stopOnPonderhit;
   std::atomic_bool ponder;
+  Timer timer;
+  TimePoint deadline;
+  bool timerArmed;
+  TimePoint lastInfoTime = now(); // Of the last debug statistics printed
+};
+
+
+/// Breadcrumbs are used to mark nodes as being searched by a given thread
+
+struct Breadcrumb {
+  std::atomic<Thread*> thread;
+  std::atomic<Key> key;
 };
 
 
@@ -101,18 +140,32 @@ struct MainThread : public Thread {
 
 struct ThreadPool : public std::vector<Thread*> {
 
-  void start_thinking(Position&, StateListPtr&, const Search::LimitsType&, bool = false);
+  void start_thinking(UCI::OptionsMap&, Position&, StateListPtr&, const Search::LimitsType&, bool = false);
   void clear();
-  void set(size_t);
+  void set(Search::SharedState, size_t);
 
   MainThread* main()        const { return static_cast<MainThread*>(front()); }
   uint64_t nodes_searched() const { return accumulate(&Thread::nodes); }
   uint64_t tb_hits()        const { return accumulate(&Thread::tbHits); }
   Thread* get_best_thread() const;
+
+  // Lazy SMP only marks the nodes of the first plies, and uses the first
+  // 1024 entries of the table. ABDADA marks many more nodes and uses it all.
+  Breadcrumb& breadcrumb(Key key) {
+    return breadcrumbs[key & ((abdada ? breadcrumbs.size() : 1024) - 1)];
+  }
+
   void start_searching();
   void wait_for_search_finished() const;
+  void wait_for_clear();
 
   std::atomic_bool stop, increaseDepth;
+  std::array<Breadcrumb, 4096> breadcrumbs{};
+  std::vector<int> cpus;   // Logical processor of each thread, if bound
+  std::vector<int> groups; // NUMA node of each thread, -1 if not bound to one
+  bool abdada = false;
+  bool clearing = false;   // Threads may still be clearing their tables
+  int idleSpin = 0;        // Microseconds of spinning before parking a thread
 
 private:
   StateListPtr setupStates;
@@ -126,6 +179,4 @@ private:
   }
 };
 
-extern ThreadPool Threads;
-
 #endif // #ifndef THREAD_H_INCLUDED
@@ -19,24 +19,24 @@
 #include <algorithm>
 #include <cfloat>
 #include <cmath>
+#include <sstream>
+#include <utility>
 
 #include "search.h"
 #include "timeman.h"
 #include "uci.h"
 
-TimeManagement Time; // Our global time management object
-
 
 /// TimeManagement::init() is called at the beginning of the search and calculates
 /// the bounds of time allowed for the current game ply. We currently support:
 //      1) x basetime (+ z increment)
 //      2) x moves in y seconds (+ z increment)
 
-void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
+void TimeManagement::init(Search::LimitsType& limits, Color us, int ply, UCI::OptionsMap& options) {
 
-  TimePoint moveOverhead    = TimePoint(Options["Move Overhead"]);
-  TimePoint slowMover       = TimePoint(Options["Slow Mover"]);
-  TimePoint npmsec          = TimePoint(Options["nodestime"]);
+  TimePoint moveOverhead    = TimePoint(options["Move Overhead"]);
+  TimePoint slowMover       = TimePoint(options["Slow Mover"]);
+  TimePoint npmsec          = TimePoint(options["nodestime"]);
 
   // optScale is a percentage of available time to use for the current move.
   // maxScale is a multiplier applied to optimumTime.
@@ -58,6 +58,7 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
   }
 
   startTime = limits.startTime;
+  useNodesTime = npmsec != 0;
 
   // Maximum move horizon of 50 moves
   int mtg = limits.movestogo ? std::min(limits.movestogo, 50) : 50;
@@ -92,6 +93,111 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
   optimumTime = TimePoint(optScale * timeLeft);
   maximumTime = TimePoint(std::min(0.8 * limits.time[us] - moveOverhead, maxScale * optimumTime));
 
-  if (Options["Ponder"])
+  if (options["Ponder"])
       optimumTime += optimumTime / 4;
 }
+
+
+/// LatencyHistogram::add() counts a duration in the bucket of the smallest power
+/// of two not below it, the first bucket gathering durations up to 1 us.
+
+void LatencyHistogram::add(int64_t us) {
+
+  int b = 0;
+
+  while (b < 31 && (int64_t(1) << b) < us)
+      ++b;
+
+  counts[b]++;
+  maximum = std::max(maximum, us);
+}
+
+
+/// LatencyHistogram::str() returns the non empty buckets, as their upper bound
+/// in microseconds followed by their count, and the maximum.
+
+std::string LatencyHistogram::str() const {
+
+  std::stringstream ss;
+
+  for (int b = 0; b < 32; ++b)
+      if (counts[b])
+          ss << "<=" << (int64_t(1) << b) << ":" << counts[b] << " ";
+
+  ss << "max " << maximum << " us";
+
+  return ss.str();
+}
+
+
+/// Timer constructor launches the thread, which waits for a deadline to be armed
+
+Timer::Timer() : thread(&Timer::idle_loop, this) {}
+
+
+/// Timer destructor wakes up the thread and waits for its termination
+
+Timer::~Timer() {
+
+  {
+      std::lock_guard<std::mutex> lk(mutex);
+      exit = true;
+  }
+
+  cv.notify_one();
+  thread.join();
+}
+
+
+/// Timer::arm() sets the deadline, in the milliseconds of now(), at which the
+/// function will be called. A new deadline replaces the previous one.
+
+void Timer::arm(TimePoint ms, std::function<void()> f) {
+
+  {
+      std::lock_guard<std::mutex> lk(mutex);
+      deadline = Clock::time_point(std::chrono::milliseconds(ms));
+      func = std::move(f);
+      armed = true;
+      fired = false;
+  }
+
+  cv.notify_one();
+}
+
+
+/// Timer::disarm() cancels the deadline, returning whether the function has
+/// been called and when. Once it has returned, the function will not be called.
+
+bool Timer::disarm(Clock::time_point& when) {
+
+  std::lock_guard<std::mutex> lk(mutex);
+
+  armed = false;
+  when = fireTime;
+
+  return std::exchange(fired, false);
+}
+
+
+/// Timer::idle_loop() sleeps until the deadline, or until it is changed. The
+/// function is called with the mutex held, to be in order with disarm().
+
+void Timer::idle_loop() {
+
+  std::unique_lock<std::mutex> lk(mutex);
+
+  while (!exit)
+  {
+      if (!armed)
+          cv.wait(lk);
+
+      else if (cv.wait_until(lk, deadline) == std::cv_status::timeout && armed && Clock::now() >= deadline)
+      {
+          fireTime = Clock::now();
+          fired = true;
+          armed = false;
+          func();
+      }
+  }
+}
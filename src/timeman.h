@@ -19,29 +19,80 @@
 #ifndef TIMEMAN_H_INCLUDED
 #define TIMEMAN_H_INCLUDED
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
 #include "misc.h"
 #include "search.h"
-#include "thread.h"
+#include "uci.h"
+
+/// LatencyHistogram counts durations, in microseconds, in buckets of powers of
+/// two, to report how late the searches stop.
+
+struct LatencyHistogram {
+
+  void add(int64_t us);
+  std::string str() const;
+
+  uint64_t counts[32] = {};
+  int64_t maximum = 0;
+};
+
+
+/// Timer is a thread that calls a function at a deadline, unless it is disarmed
+/// before. It stops the search right when the time is up, instead of waiting
+/// for the next call of check_time(), whose interval depends on the speed of
+/// the search.
+
+class Timer {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  Timer();
+ ~Timer();
+
+  void arm(TimePoint deadline, std::function<void()> f);
+  bool disarm(Clock::time_point& fireTime);
+
+private:
+  void idle_loop();
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::function<void()> func;
+  Clock::time_point deadline, fireTime;
+  bool armed = false, fired = false, exit = false;
+  std::thread thread; // Last member, started once the others are built
+};
 
 /// The TimeManagement class computes the optimal time to think depending on
 /// the maximum available time, the game move number and other parameters.
 
 class TimeManagement {
 public:
-  void init(Search::LimitsType& limits, Color us, int ply);
+  void init(Search::LimitsType& limits, Color us, int ply, UCI::OptionsMap& options);
   TimePoint optimum() const { return optimumTime; }
   TimePoint maximum() const { return maximumTime; }
-  TimePoint elapsed() const { return Search::Limits.npmsec ?
-                                     TimePoint(Threads.nodes_searched()) : now() - startTime; }
+  template<typename NodesFunc>
+  TimePoint elapsed(NodesFunc nodes) const { return useNodesTime ?
+                                                    TimePoint(nodes()) : now() - startTime; }
 
   int64_t availableNodes; // When in 'nodes as time' mode
 
+  // Searches stopped by the timer, with how late the best move was sent after
+  // the deadline (overshoot) and after the stop (stop latency).
+  uint64_t timerStops = 0;
+  LatencyHistogram overshoot, stopLatency;
+
 private:
   TimePoint startTime;
   TimePoint optimumTime;
   TimePoint maximumTime;
+  bool useNodesTime;
 };
 
-extern TimeManagement Time;
-
 #endif // #ifndef TIMEMAN_H_INCLUDED
@@ -17,21 +17,120 @@
 */
 
 #include <cstring>   // For std::memset
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <thread>
 
+#if defined(USE_AVX2)
+#include <immintrin.h>
+
+#elif defined(USE_SSE2)
+#include <emmintrin.h>
+
+#elif defined(USE_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "bitboard.h"
 #include "misc.h"
 #include "thread.h"
 #include "tt.h"
 #include "uci.h"
 
-TranspositionTable TT; // Our global transposition table
+namespace {
+
+  // Header of a transposition table snapshot file. The clusters follow it in
+  // their in-memory layout, so the header records that layout too, and a file
+  // written by a build with a different one is refused.
+  struct SnapshotHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t clusterBytes;
+    uint32_t clusterSize;
+    uint32_t generation;
+    uint64_t mbSize;
+  };
+
+  constexpr char     SnapshotMagic[8] = "SF-HASH";
+  constexpr uint32_t SnapshotVersion  = 1;
+
+  // Snapshots are streamed in chunks, directly from and into the table
+  constexpr size_t SnapshotChunk = 64 * 1024 * 1024;
+
+#if defined(USE_SSE2) || defined(USE_NEON)
+#define USE_TT_SIMD
+
+  // byte_mask() returns, for the 16 bytes of a compare result, a bitmask with
+  // one bit per byte as done by movemask on x86.
+  #if defined(USE_NEON)
+  inline uint64_t byte_mask(uint8x16_t v) {
+
+    const uint8_t w[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vandq_u8(v, vld1q_u8(w)))));
+
+    return vgetq_lane_u64(s, 0) | (vgetq_lane_u64(s, 1) << 8);
+  }
+  #endif
+
+  // match_mask() compares at once all the entries of a cluster of the given
+  // size. Entries are 10 bytes long, and in the returned bitmask the bit of
+  // the first byte of each entry, i.e. bit 10 * i, is set when its key16 is
+  // the given one or when its depth8, two bytes later, is zero.
+  template<size_t Bytes>
+  uint64_t match_mask(const void* cluster, uint16_t key16) {
+
+    static_assert(Bytes <= 64, "Cluster does not fit the bitmask");
+
+    uint64_t keys = 0, empty = 0;
+
+  #if defined(USE_AVX2)
+    const __m256i k = _mm256_set1_epi16(short(key16));
+    for (size_t i = 0; i < Bytes / 32; ++i)
+    {
+        const __m256i v = _mm256_load_si256(static_cast<const __m256i*>(cluster) + i);
+        keys  |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, k)))) << (32 * i);
+        empty |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())))) << (32 * i);
+    }
+  #elif defined(USE_SSE2)
+    const __m128i k = _mm_set1_epi16(short(key16));
+    for (size_t i = 0; i < Bytes / 16; ++i)
+    {
+        const __m128i v = _mm_load_si128(static_cast<const __m128i*>(cluster) + i);
+        keys  |= uint64_t(_mm_movemask_epi8(_mm_cmpeq_epi16(v, k))) << (16 * i);
+        empty |= uint64_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()))) << (16 * i);
+    }
+  #else
+    const uint16x8_t k = vdupq_n_u16(key16);
+    for (size_t i = 0; i < Bytes / 16; ++i)
+    {
+        const uint8x16_t v = vld1q_u8(static_cast<const uint8_t*>(cluster) + 16 * i);
+        keys  |= byte_mask(vreinterpretq_u8_u16(vceqq_u16(vreinterpretq_u16_u8(v), k))) << (16 * i);
+        empty |= byte_mask(vceqq_u8(v, vdupq_n_u8(0))) << (16 * i);
+    }
+  #endif
+
+    return keys | (empty >> 2);
+  }
+
+  // Bitmask of the first bytes of the entries of a cluster
+  constexpr uint64_t entry_bits(int entries, int size) {
+
+    uint64_t b = 0;
+    for (int i = 0; i < entries; ++i)
+        b |= 1ULL << (size * i);
+    return b;
+  }
+
+#endif
+}
 
 /// TTEntry::save() populates the TTEntry with a new node's data, possibly
 /// overwriting an old position. Update is not atomic and can be racy.
 
-void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev) {
+void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8) {
 
   // Preserve any existing move for the same position
   if (m || (uint16_t)k != key16)
@@ -47,7 +146,7 @@ void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev)
 
       key16     = (uint16_t)k;
       depth8    = (uint8_t)(d - DEPTH_OFFSET);
-      genBound8 = (uint8_t)(TT.generation8 | uint8_t(pv) << 2 | b);
+      genBound8 = (uint8_t)(generation8 | uint8_t(pv) << 2 | b);
       value16   = (int16_t)v;
       eval16    = (int16_t)ev;
   }
@@ -56,17 +155,44 @@ void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev)
 
 /// TranspositionTable::resize() sets the size of the transposition table,
 /// measured in megabytes. Transposition table consists of a power of 2 number
-/// of clusters and each cluster consists of ClusterSize number of TTEntry.
+/// of clusters and each cluster consists of ClusterSize number of TTEntry. A
+/// table of the same size and NUMA mode is kept as is. Otherwise the entries
+/// of the previous table are only kept if requested, see rehash(), as for a
+/// while both tables are then allocated: with the "Rehash" option a resize
+/// needs the memory of the old and the new table together. If there is no
+/// room for both, the previous table is dropped. It must not be called during
+/// a search.
 
-void TranspositionTable::resize(size_t mbSize) {
+void TranspositionTable::resize(size_t mbSize, size_t threadCount, bool numa, bool keep) {
 
-  Threads.main()->wait_for_search_finished();
+  const size_t newCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+  const int newNodes = numa ? std::clamp(WinProcGroup::groups_count(), 1, TTStats::MaxNodes) : 1;
 
-  aligned_large_pages_free(table);
+  if (table && newCount == clusterCount && newNodes == numaNodes)
+  {
+      lastFill = Kept;
+      return;
+  }
+
+  if (!keep)
+  {
+      aligned_large_pages_free(table);
+      table = nullptr;
+  }
+
+  Cluster* oldTable = table;
+  const size_t oldCount = clusterCount;
 
-  clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+  clusterCount = newCount;
 
   table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+  if (!table && oldTable)
+  {
+      aligned_large_pages_free(oldTable);
+      oldTable = nullptr;
+      table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+  }
+
   if (!table)
   {
       std::cerr << "Failed to allocate " << mbSize
@@ -74,37 +200,259 @@ void TranspositionTable::resize(size_t mbSize) {
       exit(EXIT_FAILURE);
   }
 
-  clear();
+  // In NUMA mode, bind each slice to its node before the pages are touched
+  numaNodes = newNodes;
+
+  if (numaNodes > 1)
+      for (int n = 0; n < numaNodes; ++n)
+          WinProcGroup::bindMemoryToGroup(&table[node_start(n)],
+                                          (node_start(n + 1) - node_start(n)) * sizeof(Cluster), n);
+
+  if (oldTable)
+      rehash(oldTable, oldCount, threadCount);
+  else
+      clear(threadCount);
+
+  aligned_large_pages_free(oldTable);
 }
 
 
-/// TranspositionTable::clear() initializes the entire transposition table to zero,
-//  in a multi-threaded way.
+/// TranspositionTable::node_start() returns the first cluster of the slice of
+/// the given node. Slices are made of whole 2MB pages, the last one takes the
+/// remaining clusters.
 
-void TranspositionTable::clear() {
+size_t TranspositionTable::node_start(int node) const {
 
-  std::vector<std::thread> threads;
+  constexpr size_t PageClusters = 2 * 1024 * 1024 / sizeof(Cluster);
+
+  if (node >= numaNodes)
+      return clusterCount;
+
+  return clusterCount * node / numaNodes / PageClusters * PageClusters;
+}
 
-  for (size_t idx = 0; idx < Options["Threads"]; ++idx)
-  {
-      threads.emplace_back([this, idx]() {
 
-          // Thread binding gives faster search on systems with a first-touch policy
-          if (Options["Threads"] > 8)
-              WinProcGroup::bindThisThread(idx);
+/// TranspositionTable::for_each_part() splits the table in parts, one per thread
+/// with as many threads as the search uses, and calls the job on each part in
+/// parallel. The threads touch the pages of their part first, so they are bound
+/// as the search threads would be.
 
-          // Each thread will zero its part of the hash table
-          const size_t stride = size_t(clusterCount / Options["Threads"]),
-                       start  = size_t(stride * idx),
-                       len    = idx != Options["Threads"] - 1 ?
-                                stride : clusterCount - start;
+void TranspositionTable::for_each_part(size_t searchThreads,
+                                       const std::function<void(size_t, size_t)>& job) {
 
-          std::memset(&table[start], 0, len * sizeof(Cluster));
+  std::vector<std::thread> threads;
+  const size_t threadCount = std::max(searchThreads, size_t(numaNodes));
+  const TimePoint startTime = now();
+
+  for (size_t idx = 0; idx < threadCount; ++idx)
+  {
+      threads.emplace_back([this, idx, threadCount, searchThreads, &job]() {
+
+          size_t start, len;
+
+          if (numaNodes > 1)
+          {
+              // In NUMA mode threads are spread over the nodes, and each thread
+              // takes its part of the slice of its own node.
+              const int node = int(idx % numaNodes);
+              const size_t count  = (threadCount - node + numaNodes - 1) / numaNodes,
+                           rank   = idx / numaNodes,
+                           first  = node_start(node),
+                           stride = (node_start(node + 1) - first) / count;
+
+              WinProcGroup::bindThisThreadToGroup(node);
+
+              start = first + stride * rank;
+              len   = rank != count - 1 ? stride : node_start(node + 1) - start;
+          }
+          else
+          {
+              // Thread binding gives faster search on systems with a first-touch policy
+              if (searchThreads > 8)
+                  WinProcGroup::bindThisThread(idx);
+
+              const size_t stride = size_t(clusterCount / threadCount);
+
+              start = size_t(stride * idx);
+              len   = idx != threadCount - 1 ? stride : clusterCount - start;
+          }
+
+          job(start, len);
       });
   }
 
   for (std::thread& th : threads)
       th.join();
+
+  clearThreads = threadCount;
+  clearTime = now() - startTime;
+}
+
+
+/// TranspositionTable::clear() initializes the entire transposition table to zero,
+//  in a multi-threaded way, with as many threads as the search uses.
+
+void TranspositionTable::clear(size_t searchThreads) {
+
+  for_each_part(searchThreads, [this](size_t start, size_t len) {
+      std::memset(&table[start], 0, len * sizeof(Cluster));
+  });
+
+  lastFill = Cleared;
+}
+
+
+/// TranspositionTable::rehash() fills the table with the entries of a previous
+/// table of another size. The index of a cluster is mul_hi64(key, clusterCount),
+/// so the keys of new cluster j lie in [j * q, (j + 1) * q + j], with q being
+/// (2^64 - 1) / clusterCount, and can only come from the old clusters indexed
+/// by the bounds of this range. Each new cluster gathers their entries, keeping
+/// the most valuable ones as probe() would, so a smaller table keeps the deepest
+/// and most recent entries. As only 16 bits of the keys are stored, a bigger
+/// table cannot tell which of the new clusters of an old one an entry belongs
+/// to: it is copied in all of them, and the copies in the wrong clusters are
+/// just replaced as they age.
+
+void TranspositionTable::rehash(const Cluster* from, size_t fromCount, size_t searchThreads) {
+
+  const uint64_t q = ~uint64_t(0) / clusterCount;
+
+  auto value = [this](const TTEntry& e) {
+      return e.depth8 - ((GENERATION_CYCLE + generation8 - e.genBound8) & GENERATION_MASK);
+  };
+
+  for_each_part(searchThreads, [&](size_t start, size_t len) {
+
+      for (size_t j = start; j < start + len; ++j)
+      {
+          const uint64_t lo = j * q, hi = (j + 1) * q;
+          const size_t first = size_t(mul_hi64(lo, fromCount)),
+                       last  = size_t(mul_hi64(hi > ~uint64_t(0) - j ? ~uint64_t(0) : hi + j, fromCount));
+
+          Cluster& c = table[j];
+          std::memset(&c, 0, sizeof(Cluster));
+
+          for (size_t i = first; i <= last; ++i)
+              for (const TTEntry& e : from[i].entry)
+              {
+                  if (!e.depth8)
+                      continue;
+
+                  // Same key or empty entry first, otherwise the least valuable
+                  TTEntry* replace = c.entry;
+                  for (TTEntry& r : c.entry)
+                      if (r.key16 == e.key16 || !r.depth8)
+                      {
+                          replace = &r;
+                          break;
+                      }
+                      else if (value(r) < value(*replace))
+                          replace = &r;
+
+                  if (!replace->depth8 || value(e) > value(*replace))
+                      *replace = e;
+              }
+      }
+  });
+
+  lastFill = Rehashed;
+}
+
+
+/// TranspositionTable::clear_info() returns, as a text to be sent as an info
+/// string, the size of the table and the time spent by the last clear, which for big tables
+/// dominates the time of a resize since pages are first touched there.
+
+std::string TranspositionTable::clear_info() const {
+
+  std::stringstream ss;
+
+  ss << "Hash " << clusterCount * sizeof(Cluster) / (1024 * 1024);
+
+  if (lastFill == Kept)
+      ss << " MB kept";
+  else
+      ss << (lastFill == Rehashed ? " MB rehashed in " : " MB cleared in ") << clearTime << " ms by " << clearThreads
+         << (numaNodes > 1 ? " threads on " + std::to_string(numaNodes) + " NUMA nodes" : " threads");
+
+  return ss.str();
+}
+
+
+/// TranspositionTable::save() writes the table and its generation to a file,
+/// so that a long analysis can later be resumed with a warm hash. It must not
+/// be called during a search.
+
+bool TranspositionTable::save(const std::string& fileName) const {
+
+  std::ofstream file(fileName, std::ios::binary);
+  SnapshotHeader header = {};
+
+  std::memcpy(header.magic, SnapshotMagic, sizeof(header.magic));
+  header.version      = SnapshotVersion;
+  header.clusterBytes = sizeof(Cluster);
+  header.clusterSize  = ClusterSize;
+  header.generation   = generation8;
+  header.mbSize       = clusterCount * sizeof(Cluster) / (1024 * 1024);
+
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  const char* data = reinterpret_cast<const char*>(table);
+  const size_t size = clusterCount * sizeof(Cluster);
+
+  for (size_t pos = 0; pos < size && file; pos += SnapshotChunk)
+      file.write(data + pos, std::streamsize(std::min(SnapshotChunk, size - pos)));
+
+  return bool(file);
+}
+
+
+/// TranspositionTable::load() reads back a table written by save(). The hash
+/// is resized to the size of the snapshot if needed, without keeping the
+/// entries which are then overwritten, and the "Hash" option is updated. On a
+/// truncated file the table is left empty. It must not be called during a
+/// search.
+
+bool TranspositionTable::load(const std::string& fileName, UCI::OptionsMap& options) {
+
+  std::ifstream file(fileName, std::ios::binary);
+  SnapshotHeader header;
+
+  if (   !file.read(reinterpret_cast<char*>(&header), sizeof(header))
+      || std::memcmp(header.magic, SnapshotMagic, sizeof(header.magic))
+      || header.version != SnapshotVersion
+      || header.clusterBytes != sizeof(Cluster)
+      || header.clusterSize != ClusterSize)
+      return false;
+
+  if (header.mbSize * 1024 * 1024 / sizeof(Cluster) != clusterCount)
+  {
+      // The option then finds the table at its size and keeps it
+      resize(size_t(header.mbSize), size_t(options["Threads"]), options["NUMA Hash"], false);
+      options["Hash"] = std::to_string(header.mbSize);
+
+      // The option silently refuses sizes out of its range
+      if (size_t(options["Hash"]) != header.mbSize)
+      {
+          resize(size_t(options["Hash"]), size_t(options["Threads"]), options["NUMA Hash"], false);
+          return false;
+      }
+  }
+
+  char* data = reinterpret_cast<char*>(table);
+  const size_t size = clusterCount * sizeof(Cluster);
+
+  for (size_t pos = 0; pos < size && file; pos += SnapshotChunk)
+      file.read(data + pos, std::streamsize(std::min(SnapshotChunk, size - pos)));
+
+  if (!file)
+  {
+      clear(size_t(options["Threads"]));
+      return false;
+  }
+
+  generation8 = uint8_t(header.generation);
+  return true;
 }
 
 
@@ -117,16 +465,35 @@ void TranspositionTable::clear() {
 
 TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
 
-  TTEntry* const tte = first_entry(key);
+  return probe_cluster(first_entry(key), key, generation8, found);
+}
+
+
+/// TranspositionTable::probe_cluster() looks up the key in the given cluster
+/// as probe() does, so that it can be shared by the hot tables.
+
+TTEntry* TranspositionTable::probe_cluster(TTEntry* const tte, const Key key, uint8_t generation8, bool& found) {
+
   const uint16_t key16 = (uint16_t)key;  // Use the low 16 bits as key inside the cluster
 
-  for (int i = 0; i < ClusterSize; ++i)
-      if (tte[i].key16 == key16 || !tte[i].depth8)
-      {
-          tte[i].genBound8 = uint8_t(generation8 | (tte[i].genBound8 & (GENERATION_DELTA - 1))); // Refresh
+  // Look for the first entry with the same key, or an empty one
+#if defined(USE_TT_SIMD)
+  constexpr uint64_t EntryBits = entry_bits(ClusterSize, sizeof(TTEntry));
 
-          return found = (bool)tte[i].depth8, &tte[i];
-      }
+  const uint64_t matches = match_mask<sizeof(Cluster)>(tte, key16) & EntryBits;
+  const int n = matches ? lsb(matches) / int(sizeof(TTEntry)) : ClusterSize;
+#else
+  int n = 0;
+  while (n < ClusterSize && tte[n].key16 != key16 && tte[n].depth8)
+      ++n;
+#endif
+
+  if (n < ClusterSize)
+  {
+      tte[n].genBound8 = uint8_t(generation8 | (tte[n].genBound8 & (GENERATION_DELTA - 1))); // Refresh
+
+      return found = (bool)tte[n].depth8, &tte[n];
+  }
 
   // Find an entry to be replaced according to the replacement strategy
   TTEntry* replace = tte;
@@ -144,6 +511,43 @@ TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
 }
 
 
+/// HotTable::probe() looks up the key as TranspositionTable::probe() does, the
+/// generation being the one of the main table.
+
+TTEntry* HotTable::probe(const Key key, bool& found, uint8_t generation8) const {
+
+  return TranspositionTable::probe_cluster(&table[mul_hi64(key, clusterCount)].entry[0], key, generation8, found);
+}
+
+
+/// HotTable::resize() sets the size of the hot table, measured in kilobytes.
+/// A zero size disables it. The table is zeroed by clear().
+
+void HotTable::resize(size_t kbSize) {
+
+  std_aligned_free(table);
+
+  clusterCount = kbSize * 1024 / sizeof(Cluster);
+  table = clusterCount ? static_cast<Cluster*>(std_aligned_alloc(64, clusterCount * sizeof(Cluster))) : nullptr;
+  if (clusterCount && !table)
+  {
+      std::cerr << "Failed to allocate " << kbSize
+                << "KB for hot transposition table." << std::endl;
+      exit(EXIT_FAILURE);
+  }
+}
+
+
+/// HotTable::clear() zeroes the hot table, from the thread owning it so that
+/// its pages are first touched there.
+
+void HotTable::clear() {
+
+  if (table)
+      std::memset(table, 0, clusterCount * sizeof(Cluster));
+}
+
+
 /// TranspositionTable::hashfull() returns an approximation of the hashtable
 /// occupation during a search. The hash is x permill full, as per UCI protocol.
 
@@ -156,3 +560,22 @@ int TranspositionTable::hashfull() const {
 
   return cnt / ClusterSize;
 }
+
+
+/// TranspositionTable::numa_info() returns the number of probes and the hit
+/// rate of the last search of the given threads for a NUMA node.
+
+std::string TranspositionTable::numa_info(const ThreadPool& threads, int node) const {
+
+  std::stringstream ss;
+  uint64_t probes = 0, hits = 0;
+
+  for (Thread* th : threads)
+      probes += th->ttStats.probes[node], hits += th->ttStats.hits[node];
+
+  ss << "NUMA node " << node << ": "
+     << probes << " hash probes, hit rate "
+     << std::fixed << std::setprecision(1) << (probes ? 100.0 * hits / probes : 0.0) << "%";
+
+  return ss.str();
+}
@@ -19,8 +19,15 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <algorithm>
+#include <functional>
+#include <string>
+
 #include "misc.h"
 #include "types.h"
+#include "uci.h"
+
+struct ThreadPool;
 
 /// TTEntry struct is the 10 bytes transposition table entry, defined as below:
 ///
@@ -41,7 +48,7 @@ struct TTEntry {
   Depth depth() const { return (Depth)depth8 + DEPTH_OFFSET; }
   bool is_pv()  const { return (bool)(genBound8 & 0x4); }
   Bound bound() const { return (Bound)(genBound8 & 0x3); }
-  void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev);
+  void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8);
 
 private:
   friend class TranspositionTable;
@@ -55,14 +62,52 @@ private:
 };
 
 
+/// TTStats counts the probes and the hits of a search thread, split by the NUMA
+/// node holding the probed cluster. Being owned by a single thread, it does not
+/// need atomic counters. Outside NUMA mode the probes are only counted when the
+/// stats are enabled, as by "bench ... tt".
+
+struct TTStats {
+
+  static constexpr int MaxNodes = 16;
+
+  void clear() { std::fill(probes, probes + MaxNodes, 0), std::fill(hits, hits + MaxNodes, 0), hotProbes = hotHits = 0; }
+  void update(int node, bool hit) { ++probes[node]; hits[node] += hit; }
+  void update_hot(bool hit) { ++hotProbes; hotHits += hit; }
+
+  uint64_t probes[MaxNodes];
+  uint64_t hits[MaxNodes];
+  uint64_t hotProbes, hotHits; // Probes of the hot table of the thread
+  bool enabled = false;
+};
+
+
 /// A TranspositionTable is an array of Cluster, of size clusterCount. Each
 /// cluster consists of ClusterSize number of TTEntry. Each non-empty TTEntry
 /// contains information on exactly one position. The size of a Cluster should
 /// divide the size of a cache line for best performance, as the cacheline is
-/// prefetched when possible.
+/// prefetched when possible. Compiling with TT_CLUSTER_64 selects clusters of
+/// 6 entries filling a whole cache line, instead of the default 3 entries.
+///
+/// In NUMA mode the array is split in one slice per node, each slice being
+/// bound to and first touched on its own node. All threads still probe the
+/// whole table, but the memory traffic is spread over all the nodes instead
+/// of saturating the memory controller of a single one.
 
 class TranspositionTable {
 
+  friend class HotTable;
+
+#if defined(TT_CLUSTER_64)
+  static constexpr int ClusterSize = 6;
+
+  struct Cluster {
+    TTEntry entry[ClusterSize];
+    char padding[4]; // Pad to 64 bytes
+  };
+
+  static_assert(sizeof(Cluster) == 64, "Unexpected Cluster size");
+#else
   static constexpr int ClusterSize = 3;
 
   struct Cluster {
@@ -71,6 +116,7 @@ class TranspositionTable {
   };
 
   static_assert(sizeof(Cluster) == 32, "Unexpected Cluster size");
+#endif
 
   // Constants used to refresh the hash table periodically
   static constexpr unsigned GENERATION_BITS  = 3;                                // nb of bits reserved for other things
@@ -81,23 +127,62 @@ class TranspositionTable {
 public:
  ~TranspositionTable() { aligned_large_pages_free(table); }
   void new_search() { generation8 += GENERATION_DELTA; } // Lower bits are used for other things
+  uint8_t generation() const { return generation8; }
   TTEntry* probe(const Key key, bool& found) const;
   int hashfull() const;
-  void resize(size_t mbSize);
-  void clear();
+  void resize(size_t mbSize, size_t threadCount, bool numa, bool keep);
+  void clear(size_t threadCount);
+  bool save(const std::string& fileName) const;
+  bool load(const std::string& fileName, UCI::OptionsMap& options);
 
   TTEntry* first_entry(const Key key) const {
     return &table[mul_hi64(key, clusterCount)].entry[0];
   }
 
-private:
-  friend struct TTEntry;
+  // Node of the slice holding the cluster of the key. Slices are rounded to
+  // whole pages, so near the slice boundaries this is only an approximation.
+  int numa_node(const Key key) const { return int(mul_hi64(key, numaNodes)); }
+  int numa_nodes() const { return numaNodes; }
+  std::string numa_info(const ThreadPool& threads, int node) const;
+  std::string clear_info() const;
 
-  size_t clusterCount;
-  Cluster* table;
-  uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
+private:
+  static TTEntry* probe_cluster(TTEntry* const tte, const Key key, uint8_t generation8, bool& found);
+  size_t node_start(int node) const;
+  void for_each_part(size_t searchThreads, const std::function<void(size_t, size_t)>& job);
+  void rehash(const Cluster* from, size_t fromCount, size_t searchThreads);
+
+  size_t clusterCount = 0;
+  Cluster* table = nullptr;
+  int numaNodes = 1;
+  size_t clearThreads = 0;
+  TimePoint clearTime = 0;
+  enum Fill { Cleared, Rehashed, Kept }; // How the table was last filled
+  Fill lastFill = Cleared;
+  uint8_t generation8 = 0; // Size must be not bigger than TTEntry::genBound8
 };
 
-extern TranspositionTable TT;
+
+/// HotTable is a small transposition table private to a search thread, sized to
+/// stay in the L2 cache, which holds the entries of the quiescence search. It
+/// sits in front of the main table: a miss falls back to the main table, whose
+/// entry is then copied in the hot one, but the shallow entries are stored only
+/// in the hot table, so they do not evict the deep entries of the main one.
+
+class HotTable {
+
+  typedef TranspositionTable::Cluster Cluster;
+
+public:
+ ~HotTable() { std_aligned_free(table); }
+  bool enabled() const { return clusterCount; }
+  TTEntry* probe(const Key key, bool& found, uint8_t generation8) const;
+  void resize(size_t kbSize);
+  void clear();
+
+private:
+  size_t clusterCount = 0;
+  Cluster* table = nullptr;
+};
 
 #endif // #ifndef TT_H_INCLUDED
@@ -27,6 +27,7 @@
 using std::string;
 
 bool Tune::update_on_last;
+UCI::OptionsMap* Tune::options;
 const UCI::Option* LastOption = nullptr;
 BoolConditions Conditions;
 static std::map<std::string, int> TuneResults;
@@ -65,8 +66,8 @@ static void make_option(const string& n, int v, const SetRange& r) {
   if (TuneResults.count(n))
       v = TuneResults[n];
 
-  Options[n] << UCI::Option(v, r(v).first, r(v).second, on_tune);
-  LastOption = &Options[n];
+  (*Tune::options)[n] << UCI::Option(v, r(v).first, r(v).second, on_tune);
+  LastOption = &(*Tune::options)[n];
 
   // Print formatted parameters, ready to be copy-pasted in Fishtest
   std::cout << n << ","
@@ -77,18 +78,26 @@ static void make_option(const string& n, int v, const SetRange& r) {
             << std::endl;
 }
 
+void Tune::init(UCI::OptionsMap& o) {
+
+  options = &o;
+  for (auto& e : instance().list)
+      e->init_option();
+  read_options();
+}
+
 template<> void Tune::Entry<int>::init_option() { make_option(name, value, range); }
 
 template<> void Tune::Entry<int>::read_option() {
-  if (Options.count(name))
-      value = int(Options[name]);
+  if (options->count(name))
+      value = int((*options)[name]);
 }
 
 template<> void Tune::Entry<Value>::init_option() { make_option(name, value, range); }
 
 template<> void Tune::Entry<Value>::read_option() {
-  if (Options.count(name))
-      value = Value(int(Options[name]));
+  if (options->count(name))
+      value = Value(int((*options)[name]));
 }
 
 template<> void Tune::Entry<Score>::init_option() {
@@ -97,11 +106,11 @@ template<> void Tune::Entry<Score>::init_option() {
 }
 
 template<> void Tune::Entry<Score>::read_option() {
-  if (Options.count("m" + name))
-      value = make_score(int(Options["m" + name]), eg_value(value));
+  if (options->count("m" + name))
+      value = make_score(int((*options)["m" + name]), eg_value(value));
 
-  if (Options.count("e" + name))
-      value = make_score(mg_value(value), int(Options["e" + name]));
+  if (options->count("e" + name))
+      value = make_score(mg_value(value), int((*options)["e" + name]));
 }
 
 // Instead of a variable here we have a PostUpdate function: just call it
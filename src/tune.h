@@ -19,11 +19,18 @@
 #ifndef TUNE_H_INCLUDED
 #define TUNE_H_INCLUDED
 
+#include <map>
 #include <memory>
 #include <string>
 #include <type_traits>
 #include <vector>
 
+namespace UCI { // Included by types.h, so uci.h cannot be included here
+class Option;
+struct CaseInsensitiveLess;
+typedef std::map<std::string, Option, CaseInsensitiveLess> OptionsMap;
+}
+
 typedef std::pair<int, int> Range; // Option's min-max values
 typedef Range (RangeFun) (int);
 
@@ -172,9 +179,10 @@ public:
   static int add(const std::string& names, Args&&... args) {
     return instance().add(SetDefaultRange, names.substr(1, names.size() - 2), args...); // Remove trailing parenthesis
   }
-  static void init() { for (auto& e : instance().list) e->init_option(); read_options(); } // Deferred, due to UCI::Options access
+  static void init(UCI::OptionsMap& o); // Deferred, due to UCI::Options access
   static void read_options() { for (auto& e : instance().list) e->read_option(); }
   static bool update_on_last;
+  static UCI::OptionsMap* options;
 };
 
 // Some macro magic :-) we define a dummy int variable that compiler initializes calling Tune::add()
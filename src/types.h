@@ -35,6 +35,10 @@
 ///
 /// -DUSE_PEXT    | Add runtime support for use of pext asm-instruction. Works
 ///               | only in 64-bit mode and requires hardware with pext support.
+///
+/// -DUSE_DISPATCH | Detect popcnt and pext support at startup and select the
+///               | NNUE code compiled for the best instruction set of the CPU.
+///               | Requires gcc or a compatible compiler on x86-64.
 
 #include <cassert>
 #include <cctype>
@@ -79,18 +83,30 @@
 #if defined(USE_PEXT)
 #  include <immintrin.h> // Header for _pext_u64() intrinsic
 #  define pext(b, m) _pext_u64(b, m)
+#elif defined(USE_DISPATCH)
+// In a dispatch build pext is emitted with inline assembly, so that it can be
+// inlined in code compiled without -mbmi2. It is only executed when HasPext.
+inline uint64_t pext(uint64_t b, uint64_t m) {
+  uint64_t r;
+  __asm__("pextq %2, %1, %0" : "=r" (r) : "r" (b), "rm" (m));
+  return r;
+}
 #else
 #  define pext(b, m) 0
 #endif
 
 #ifdef USE_POPCNT
 constexpr bool HasPopCnt = true;
+#elif defined(USE_DISPATCH)
+extern bool HasPopCnt; // Set at startup from the CPU features, see misc.cpp
 #else
 constexpr bool HasPopCnt = false;
 #endif
 
 #ifdef USE_PEXT
 constexpr bool HasPext = true;
+#elif defined(USE_DISPATCH)
+extern bool HasPext; // Set at startup from the CPU features, see misc.cpp
 #else
 constexpr bool HasPext = false;
 #endif
@@ -16,15 +16,23 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <numeric>
 #include <sstream>
 #include <string>
+#include <thread>
 
+#include "engine.h"
 #include "evaluate.h"
 #include "movegen.h"
 #include "position.h"
+#include "scheduler.h"
 #include "search.h"
 #include "thread.h"
 #include "timeman.h"
@@ -38,25 +46,21 @@ extern vector<string> setup_bench(const Position&, istream&);
 
 namespace {
 
-  // FEN string of the initial position, normal chess
-  const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
-
-
   // position() is called when engine receives the "position" UCI command.
   // The function sets up the position described in the given FEN string ("fen")
   // or the starting position ("startpos") and then makes the moves given in the
   // following move list ("moves").
 
-  void position(Position& pos, istringstream& is, StateListPtr& states) {
+  void position(Engine& engine, istringstream& is) {
 
-    Move m;
     string token, fen;
+    vector<string> moves;
 
     is >> token;
 
     if (token == "startpos")
     {
-        fen = StartFEN;
+        fen = Engine::StartFEN;
         is >> token; // Consume "moves" token if any
     }
     else if (token == "fen")
@@ -65,36 +69,126 @@ namespace {
     else
         return;
 
-    states = StateListPtr(new std::deque<StateInfo>(1)); // Drop old and create a new one
-    pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
-
     // Parse move list (if any)
-    while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
-    {
-        states->emplace_back();
-        pos.do_move(m, states->back());
-    }
+    while (is >> token)
+        moves.push_back(token);
+
+    engine.set_position(fen, moves);
   }
 
   // trace_eval() prints the evaluation for the current position, consistent with the UCI
   // options set so far.
 
-  void trace_eval(Position& pos) {
+  void trace_eval(Engine& engine) {
 
     StateListPtr states(new std::deque<StateInfo>(1));
     Position p;
-    p.set(pos.fen(), Options["UCI_Chess960"], &states->back(), Threads.main());
+    p.set(engine.pos.fen(), engine.options["UCI_Chess960"], &states->back(), engine.threads.main());
 
-    Eval::NNUE::verify();
+    Eval::NNUE::verify(engine.options, engine.updates.onInfoString);
 
     sync_cout << "\n" << Eval::trace(p) << sync_endl;
   }
 
 
+  // nnue_bench() is called when engine receives the "nnuebench" command. It
+  // times the NNUE evaluation of the current position, by default 100000 times.
+  // The position uses the caches of the main thread, which must not be searching.
+
+  void nnue_bench(Engine& engine, istringstream& is) {
+
+    int iterations = 100000;
+    is >> iterations;
+
+    engine.wait_for_search_finished();
+
+    StateListPtr states(new std::deque<StateInfo>(1));
+    Position p;
+    p.set(engine.pos.fen(), engine.options["UCI_Chess960"], &states->back(), engine.threads.main());
+
+    Eval::NNUE::verify(engine.options, engine.updates.onInfoString);
+
+    if (Eval::useNNUE)
+        sync_cout << Eval::NNUE::benchmark(p, std::max(iterations, 1)) << sync_endl;
+  }
+
+
+  // timestats() is called when engine receives the "timestats" command. It
+  // reports, over the searches stopped by the timer since the start, how late
+  // the best move was sent after the deadline and after the stop was raised.
+
+  void timestats(Engine& engine) {
+
+    engine.wait_for_search_finished();
+
+    const TimeManagement& tm = engine.threads.main()->tm;
+
+    sync_cout << "Searches stopped by the timer: " << tm.timerStops
+              << "\nOvershoot    : " << tm.overshoot.str()
+              << "\nStop latency : " << tm.stopLatency.str() << sync_endl;
+  }
+
+  // latency() is called when engine receives the "latency" command. It times,
+  // averaged over a number of searches of the current position (100 by default),
+  // the wakeup of the threads from "go" until each has searched its first node,
+  // and the time from "stop" until the best move is sent.
+
+  void latency(Engine& engine, istringstream& is) {
+
+    using namespace std::chrono;
+
+    int iterations = 100;
+    is >> iterations;
+    iterations = std::max(iterations, 1);
+
+    if (!MoveList<LEGAL>(engine.pos).size())
+    {
+        sync_cout << "No legal moves" << sync_endl;
+        return;
+    }
+
+    // Searches are quiet, the best move being only timed
+    Search::UpdateContext updates = engine.updates;
+    steady_clock::time_point bestMoveTime;
+
+    engine.updates = Search::UpdateContext();
+    engine.updates.onBestMove = [&](Move, Move) { bestMoveTime = steady_clock::now(); };
+
+    Search::LimitsType limits;
+    limits.infinite = 1;
+    double goTime = 0, stopTime = 0;
+
+    for (int i = 0; i < iterations; ++i)
+    {
+        limits.startTime = now();
+        auto start = steady_clock::now();
+
+        engine.go(limits);
+
+        while (std::any_of(engine.threads.begin(), engine.threads.end(), [](Thread* th) { return !th->nodes; }))
+            std::this_thread::yield();
+
+        auto firstNode = steady_clock::now();
+        auto stop = steady_clock::now();
+
+        engine.stop();
+        engine.wait_for_search_finished();
+
+        goTime   += duration<double, std::micro>(firstNode - start).count();
+        stopTime += duration<double, std::micro>(bestMoveTime - stop).count();
+    }
+
+    engine.updates = updates;
+
+    sync_cout << "Go to first node (us) : " << fixed << setprecision(1) << goTime / iterations
+              << "\nStop to bestmove (us) : " << stopTime / iterations << sync_endl;
+  }
+
+
   // setoption() is called when engine receives the "setoption" UCI command. The
   // function updates the UCI option ("name") to the given value ("value").
 
-  void setoption(istringstream& is) {
+  void setoption(Engine& engine, istringstream& is) {
 
     string token, name, value;
 
@@ -108,18 +202,56 @@ namespace {
     while (is >> token)
         value += (value.empty() ? "" : " ") + token;
 
-    if (Options.count(name))
-        Options[name] = value;
+    if (engine.options.count(name))
+        engine.options[name] = value;
     else
         sync_cout << "No such option: " << name << sync_endl;
   }
 
 
+  // hash_file() is called when engine receives the "savehash" or "loadhash"
+  // commands. It saves the transposition table to the given file, or loads
+  // it back from there, once the search has finished writing to it.
+
+  void hash_file(Engine& engine, const string& token, istringstream& is) {
+
+    string fileName;
+
+    // Read file name (can contain spaces)
+    getline(is >> ws, fileName);
+
+    engine.wait_for_search_finished();
+
+    bool ok = token == "savehash" ? engine.tt.save(fileName) : engine.tt.load(fileName, engine.options);
+
+    sync_cout << "info string " << (token == "savehash" ? "Saving" : "Loading")
+              << " hash file " << fileName << (ok ? " done" : " failed") << sync_endl;
+  }
+
+
+  // save_net() is called when engine receives the "savenet" command. It writes
+  // the image of the network in use to the given file, to be used later as the
+  // EvalFile option, mapped in memory instead of read.
+
+  void save_net(istringstream& is) {
+
+    string fileName;
+
+    // Read file name (can contain spaces)
+    getline(is >> ws, fileName);
+
+    bool ok = Eval::useNNUE && Eval::NNUE::save_image(fileName);
+
+    sync_cout << "info string Saving network image " << fileName
+              << (ok ? " done" : " failed") << sync_endl;
+  }
+
+
   // go() is called when engine receives the "go" UCI command. The function sets
   // the thinking time and other parameters from the input string, then starts
   // the search.
 
-  void go(Position& pos, istringstream& is, StateListPtr& states) {
+  void go(Engine& engine, istringstream& is) {
 
     Search::LimitsType limits;
     string token;
@@ -130,7 +262,7 @@ namespace {
     while (is >> token)
         if (token == "searchmoves") // Needs to be the last command on the line
             while (is >> token)
-                limits.searchmoves.push_back(UCI::to_move(pos, token));
+                limits.searchmoves.push_back(UCI::to_move(engine.pos, token));
 
         else if (token == "wtime")     is >> limits.time[WHITE];
         else if (token == "btime")     is >> limits.time[BLACK];
@@ -145,7 +277,7 @@ namespace {
         else if (token == "infinite")  limits.infinite = 1;
         else if (token == "ponder")    ponderMode = true;
 
-    Threads.start_thinking(pos, states, limits, ponderMode);
+    engine.go(limits, ponderMode);
   }
 
 
@@ -153,12 +285,16 @@ namespace {
   // a list of UCI commands is setup according to bench parameters, then
   // it is run one by one printing a summary at the end.
 
-  void bench(Position& pos, istream& args, StateListPtr& states) {
+  void bench(Engine& engine, istream& args) {
 
     string token;
-    uint64_t num, nodes = 0, cnt = 1;
+    uint64_t num, nodes = 0, cnt = 1, ttProbes = 0, ttHits = 0, hotProbes = 0, hotHits = 0, refreshes = 0, cacheHits = 0;
+    uint64_t evalHits = 0, evalMisses = 0;
+    map<int, uint64_t> groupNodes; // Nodes searched by the threads of each NUMA node
+    uint64_t density[Eval::NNUE::AccumulatorCache::kDensityBuckets] = {};
+    bool densityStats = false, ttStats = false;
 
-    vector<string> list = setup_bench(pos, args);
+    vector<string> list = setup_bench(engine.pos, args);
     num = count_if(list.begin(), list.end(), [](string s) { return s.find("go ") == 0 || s.find("eval") == 0; });
 
     TimePoint elapsed = now();
@@ -170,19 +306,47 @@ namespace {
 
         if (token == "go" || token == "eval")
         {
-            cerr << "\nPosition: " << cnt++ << '/' << num << " (" << pos.fen() << ")" << endl;
+            cerr << "\nPosition: " << cnt++ << '/' << num << " (" << engine.pos.fen() << ")" << endl;
             if (token == "go")
             {
-               go(pos, is, states);
-               Threads.main()->wait_for_search_finished();
-               nodes += Threads.nodes_searched();
+               for (Thread* th : engine.threads)
+                   th->accumulatorCache.densityStats = densityStats,
+                   th->ttStats.enabled = ttStats;
+
+               go(engine, is);
+               engine.wait_for_search_finished();
+               nodes += engine.threads.nodes_searched();
+
+               for (size_t i = 0; i < engine.threads.size(); ++i)
+                   groupNodes[engine.threads.groups[i]] += engine.threads[i]->nodes;
+
+               for (Thread* th : engine.threads)
+                   ttProbes += accumulate(th->ttStats.probes, th->ttStats.probes + TTStats::MaxNodes, uint64_t(0)),
+                   ttHits   += accumulate(th->ttStats.hits,   th->ttStats.hits   + TTStats::MaxNodes, uint64_t(0)),
+                   hotProbes += th->ttStats.hotProbes,
+                   hotHits   += th->ttStats.hotHits,
+                   refreshes += th->accumulatorCache.refreshes,
+                   cacheHits += th->accumulatorCache.hits,
+                   evalHits   += th->evalCache.hits,
+                   evalMisses += th->evalCache.misses;
+
+               for (Thread* th : engine.threads)
+               {
+                   for (int i = 0; i < Eval::NNUE::AccumulatorCache::kDensityBuckets; ++i)
+                       density[i] += th->accumulatorCache.density[i];
+
+                   th->accumulatorCache.densityStats = false;
+                   th->ttStats.enabled = false;
+               }
             }
             else
-               trace_eval(pos);
+               trace_eval(engine);
         }
-        else if (token == "setoption")  setoption(is);
-        else if (token == "position")   position(pos, is, states);
-        else if (token == "ucinewgame") { Search::clear(); elapsed = now(); } // Search::clear() may take some while
+        else if (token == "setoption")  setoption(engine, is);
+        else if (token == "position")   position(engine, is);
+        else if (token == "density")    densityStats = true;
+        else if (token == "tt")         ttStats = true;
+        else if (token == "ucinewgame") { engine.search_clear(); engine.wait_for_clear(); elapsed = now(); } // Search clear may take some while
     }
 
     elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
@@ -192,7 +356,121 @@ namespace {
     cerr << "\n==========================="
          << "\nTotal time (ms) : " << elapsed
          << "\nNodes searched  : " << nodes
-         << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+         << "\nNodes/second    : " << 1000 * nodes / elapsed
+         << "\nNNUE refreshes  : " << refreshes << " (" << cacheHits << " from cache)" << endl;
+
+    cerr << fixed << setprecision(2);
+
+    // The probes are counted in NUMA mode or with "bench ... tt"
+    if (ttProbes)
+        cerr << "TT hit rate (%) : " << 100.0 * ttHits / ttProbes << endl;
+
+    // With hot tables, the hit rate above is the one of the main table, only
+    // probed by the quiescence search on a miss in the hot table.
+    if (hotProbes)
+        cerr << "Hot TT probes   : " << hotProbes
+             << "\nHot TT hit (%)  : " << 100.0 * hotHits / hotProbes << endl;
+
+    // Compare the nodes/second with the ones of a bench without the cache
+    if (evalHits + evalMisses)
+        cerr << "Eval cache hits : " << evalHits << " of " << evalHits + evalMisses << " probes"
+             << "\nEval cache (%)  : " << 100.0 * evalHits / (evalHits + evalMisses) << endl;
+
+    // Density of the transformed features of the NNUE evaluations, i.e. the
+    // share of the input chunks propagated by the sparse first layer
+    uint64_t evals = accumulate(begin(density), end(density), uint64_t(0));
+
+    if (evals)
+    {
+        cerr << "NNUE density    : evaluations per non-zero input share" << endl;
+        for (int i = 0; i < Eval::NNUE::AccumulatorCache::kDensityBuckets; ++i)
+            if (density[i])
+                cerr << setw(6) << 100 * i / (Eval::NNUE::AccumulatorCache::kDensityBuckets - 1) << "%  : "
+                     << setw(10) << density[i] << " (" << setprecision(1) << 100.0 * density[i] / evals << "%)" << endl;
+    }
+
+    // Threads bound to NUMA nodes, whose memory is local unless "NUMA Threads"
+    // is off, show the speed of each node
+    for (const auto& [group, n] : groupNodes)
+        if (group >= 0)
+            cerr << "NUMA node " << group << " nps : " << 1000 * n / elapsed << endl;
+  }
+
+  // scheduler() is called when engine receives the "scheduler" command. The
+  // input is then handed over to a scheduler of many games until "quit". By
+  // default there are as many workers as threads, each with a hash of the size
+  // set for the engine.
+
+  void scheduler(Engine& engine, istringstream& is) {
+
+    string token;
+    int workers = (is >> token) ? stoi(token) : int(engine.options["Threads"]);
+    int hashMB  = (is >> token) ? stoi(token) : int(engine.options["Hash"]);
+
+    engine.wait_for_search_finished();
+
+    Scheduler(engine, size_t(std::max(workers, 1)), size_t(std::max(hashMB, 1))).loop(cin);
+  }
+
+  // set_updates() installs the callbacks printing the search reports of the
+  // engine in the format defined by the UCI protocol.
+
+  void set_updates(Engine& engine) {
+
+    Search::UpdateContext& updates = engine.updates;
+
+    updates.onUpdateNoMoves = [](const Search::InfoShort& info) {
+        sync_cout << "info depth " << info.depth << " score " << UCI::value(info.score) << sync_endl;
+    };
+
+    updates.onUpdateFull = [&engine](const Search::InfoFull& info) {
+        stringstream ss;
+
+        ss << "info"
+           << " depth "    << info.depth
+           << " seldepth " << info.selDepth
+           << " multipv "  << info.multiPV
+           << " score "    << UCI::value(info.score);
+
+        if (engine.options["UCI_ShowWDL"])
+            ss << UCI::wdl(info.score, engine.pos.game_ply());
+
+        ss << (info.bound == BOUND_LOWER ? " lowerbound" : info.bound == BOUND_UPPER ? " upperbound" : "");
+
+        ss << " nodes "    << info.nodes
+           << " nps "      << info.nps;
+
+        if (info.hashfull >= 0)
+            ss << " hashfull " << info.hashfull;
+
+        ss << " tbhits "   << info.tbHits
+           << " time "     << info.time
+           << " pv";
+
+        for (Move m : info.pv)
+            ss << " " << UCI::move(m, engine.pos.is_chess960());
+
+        sync_cout << ss.str() << sync_endl;
+    };
+
+    updates.onIter = [&engine](const Search::InfoIteration& info) {
+        sync_cout << "info depth " << info.depth
+                  << " currmove " << UCI::move(info.currmove, engine.pos.is_chess960())
+                  << " currmovenumber " << info.currmovenumber << sync_endl;
+    };
+
+    updates.onBestMove = [&engine](Move bestMove, Move ponder) {
+        sync_cout << "bestmove " << UCI::move(bestMove, engine.pos.is_chess960());
+
+        if (ponder != MOVE_NONE)
+            std::cout << " ponder " << UCI::move(ponder, engine.pos.is_chess960());
+
+        std::cout << sync_endl;
+    };
+
+    updates.onInfoString = [](const string& str) {
+        sync_cout << "info string " << str << sync_endl;
+    };
   }
 
   // The win rate model returns the probability (per mille) of winning given an eval
@@ -226,13 +504,11 @@ namespace {
 /// run 'bench', once the command is executed the function returns immediately.
 /// In addition to the UCI ones, also some additional debug commands are supported.
 
-void UCI::loop(int argc, char* argv[]) {
+void UCI::loop(Engine& engine, int argc, char* argv[]) {
 
-  Position pos;
   string token, cmd;
-  StateListPtr states(new std::deque<StateInfo>(1));
 
-  pos.set(StartFEN, false, &states->back(), Threads.main());
+  set_updates(engine);
 
   for (int i = 1; i < argc; ++i)
       cmd += std::string(argv[i]) + " ";
@@ -248,33 +524,47 @@ void UCI::loop(int argc, char* argv[]) {
 
       if (    token == "quit"
           ||  token == "stop")
-          Threads.stop = true;
+          engine.stop();
 
       // The GUI sends 'ponderhit' to tell us the user has played the expected move.
       // So 'ponderhit' will be sent if we were told to ponder on the same move the
       // user has played. We should continue searching but switch from pondering to
       // normal search.
       else if (token == "ponderhit")
-          Threads.main()->ponder = false; // Switch to normal search
+          engine.ponderhit(); // Switch to normal search
 
       else if (token == "uci")
           sync_cout << "id name " << engine_info(true)
-                    << "\n"       << Options
+                    << "\n"       << engine.options
                     << "\nuciok"  << sync_endl;
 
-      else if (token == "setoption")  setoption(is);
-      else if (token == "go")         go(pos, is, states);
-      else if (token == "position")   position(pos, is, states);
-      else if (token == "ucinewgame") Search::clear();
-      else if (token == "isready")    sync_cout << "readyok" << sync_endl;
+      else if (token == "setoption")  setoption(engine, is);
+      else if (token == "go")         go(engine, is);
+      else if (token == "position")   position(engine, is);
+      else if (token == "ucinewgame")
+      {
+          engine.search_clear();
+          Tablebases::init(engine.options["SyzygyPath"]); // Free mapped files
+      }
+      else if (token == "isready")
+      {
+          engine.wait_for_clear(); // The threads may still be clearing after ucinewgame
+          sync_cout << "readyok" << sync_endl;
+      }
 
       // Additional custom non-UCI commands, mainly for debugging.
       // Do not use these commands during a search!
-      else if (token == "flip")     pos.flip();
-      else if (token == "bench")    bench(pos, is, states);
-      else if (token == "d")        sync_cout << pos << sync_endl;
-      else if (token == "eval")     trace_eval(pos);
+      else if (token == "flip")     engine.pos.flip();
+      else if (token == "bench")    bench(engine, is);
+      else if (token == "d")        sync_cout << engine.pos << sync_endl;
+      else if (token == "eval")     trace_eval(engine);
+      else if (token == "nnuebench") nnue_bench(engine, is);
+      else if (token == "latency")  latency(engine, is);
+      else if (token == "timestats") timestats(engine);
       else if (token == "compiler") sync_cout << compiler_info() << sync_endl;
+      else if (token == "savehash" || token == "loadhash") hash_file(engine, token, is);
+      else if (token == "savenet")  save_net(is);
+      else if (token == "scheduler") { scheduler(engine, is); token = "quit"; }
       else
           sync_cout << "Unknown command: " << cmd << sync_endl;
 
@@ -19,11 +19,14 @@
 #ifndef UCI_H_INCLUDED
 #define UCI_H_INCLUDED
 
+#include <functional>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "types.h"
 
+class Engine;
 class Position;
 
 namespace UCI {
@@ -41,7 +44,7 @@ typedef std::map<std::string, Option, CaseInsensitiveLess> OptionsMap;
 /// Option class implements an option as defined by UCI protocol
 class Option {
 
-  typedef void (*OnChange)(const Option&);
+  typedef std::function<void(const Option&)> OnChange;
 
 public:
   Option(OnChange = nullptr);
@@ -58,6 +61,7 @@ public:
 
 private:
   friend std::ostream& operator<<(std::ostream&, const OptionsMap&);
+  friend void copy(OptionsMap&, const OptionsMap&, const std::vector<std::string>&);
 
   std::string defaultValue, currentValue, type;
   int min, max;
@@ -65,17 +69,15 @@ private:
   OnChange on_change;
 };
 
-void init(OptionsMap&);
-void loop(int argc, char* argv[]);
+void init(OptionsMap&, Engine&);
+void copy(OptionsMap& to, const OptionsMap& from, const std::vector<std::string>& except);
+void loop(Engine&, int argc, char* argv[]);
 std::string value(Value v);
 std::string square(Square s);
 std::string move(Move m, bool chess960);
-std::string pv(const Position& pos, Depth depth, Value alpha, Value beta);
 std::string wdl(Value v, int ply);
 Move to_move(const Position& pos, std::string& str);
 
 } // namespace UCI
 
-extern UCI::OptionsMap Options;
-
 #endif // #ifndef UCI_H_INCLUDED
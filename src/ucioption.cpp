@@ -20,29 +20,22 @@
 #include <cassert>
 #include <ostream>
 #include <sstream>
+#include <vector>
 
+#include "engine.h"
 #include "evaluate.h"
 #include "misc.h"
-#include "search.h"
-#include "thread.h"
-#include "tt.h"
 #include "uci.h"
 #include "syzygy/tbprobe.h"
 
 using std::string;
 
-UCI::OptionsMap Options; // Global object
-
 namespace UCI {
 
-/// 'On change' actions, triggered by an option's value change
-void on_clear_hash(const Option&) { Search::clear(); }
-void on_hash_size(const Option& o) { TT.resize(size_t(o)); }
+/// 'On change' actions, triggered by an option's value change. Those of the
+/// instance are set up by init(), the others act on the whole process.
 void on_logger(const Option& o) { start_logger(o); }
-void on_threads(const Option& o) { Threads.set(size_t(o)); }
 void on_tb_path(const Option& o) { Tablebases::init(o); }
-void on_use_NNUE(const Option& ) { Eval::NNUE::init(); }
-void on_eval_file(const Option& ) { Eval::NNUE::init(); }
 
 /// Our case insensitive less() function as required by UCI protocol
 bool CaseInsensitiveLess::operator() (const string& s1, const string& s2) const {
@@ -52,17 +45,31 @@ bool CaseInsensitiveLess::operator() (const string& s1, const string& s2) const
 }
 
 
-/// UCI::init() initializes the UCI options to their hard-coded default values
+/// UCI::init() initializes the UCI options of an engine instance to their
+/// hard-coded default values.
 
-void init(OptionsMap& o) {
+void init(OptionsMap& o, Engine& engine) {
 
   constexpr int MaxHashMB = Is64Bit ? 33554432 : 2048;
 
+  auto on_clear_hash = [&](const Option&) { engine.search_clear(); engine.updates.onInfoString(engine.tt.clear_info()); };
+  auto on_hash_size  = [&](const Option&) { engine.resize_tt(); };
+  auto on_threads    = [&](const Option&) { engine.resize_threads(); };
+  auto on_eval       = [&](const Option&) { engine.set_eval(); };
+
   o["Debug Log File"]        << Option("", on_logger);
   o["Contempt"]              << Option(24, -100, 100);
   o["Analysis Contempt"]     << Option("Both var Off var White var Black var Both", "Both");
   o["Threads"]               << Option(1, 1, 512, on_threads);
+  o["SMP Mode"]              << Option("Lazy var Lazy var ABDADA", "Lazy");
+  o["CPU List"]              << Option("<empty>", on_threads);
+  o["NUMA Threads"]          << Option(true, on_threads);
+  o["Idle Spin"]             << Option(0, 0, 100000, on_threads);
   o["Hash"]                  << Option(16, 1, MaxHashMB, on_hash_size);
+  o["NUMA Hash"]             << Option(false, on_hash_size);
+  o["Rehash"]                << Option(false);
+  o["Hot Hash"]              << Option(0, 0, 16384, on_threads);
+  o["Eval Cache"]            << Option(0, 0, 65536, on_threads);
   o["Clear Hash"]            << Option(on_clear_hash);
   o["Ponder"]                << Option(false);
   o["MultiPV"]               << Option(1, 1, 500);
@@ -79,8 +86,23 @@ void init(OptionsMap& o) {
   o["SyzygyProbeDepth"]      << Option(1, 1, 100);
   o["Syzygy50MoveRule"]      << Option(true);
   o["SyzygyProbeLimit"]      << Option(7, 0, 7);
-  o["Use NNUE"]              << Option(true, on_use_NNUE);
-  o["EvalFile"]              << Option(EvalFileDefaultName, on_eval_file);
+  o["Use NNUE"]              << Option(true, on_eval);
+  o["EvalFile"]              << Option(EvalFileDefaultName, on_eval);
+}
+
+
+/// UCI::copy() sets the options of an instance to the values of another one,
+/// but for buttons, options not present in both and the ones listed as
+/// exceptions. Only the changed values are set, to avoid needless actions.
+
+void copy(OptionsMap& to, const OptionsMap& from, const std::vector<string>& except) {
+
+  for (const auto& [name, o] : from)
+      if (   o.type != "button"
+          && to.count(name)
+          && to[name].currentValue != o.currentValue
+          && std::find(except.begin(), except.end(), name) == except.end())
+          to[name] = o.currentValue;
 }
 
 
@@ -89,23 +111,27 @@ void init(OptionsMap& o) {
 
 std::ostream& operator<<(std::ostream& os, const OptionsMap& om) {
 
-  for (size_t idx = 0; idx < om.size(); ++idx)
-      for (const auto& it : om)
-          if (it.second.idx == idx)
-          {
-              const Option& o = it.second;
-              os << "\noption name " << it.first << " type " << o.type;
+  // The insertion order is shared by all the maps, so sort instead of counting
+  std::vector<const OptionsMap::value_type*> options;
+
+  for (const auto& it : om)
+      options.push_back(&it);
 
-              if (o.type == "string" || o.type == "check" || o.type == "combo")
-                  os << " default " << o.defaultValue;
+  std::sort(options.begin(), options.end(), [](auto a, auto b) { return a->second.idx < b->second.idx; });
 
-              if (o.type == "spin")
-                  os << " default " << int(stof(o.defaultValue))
-                     << " min "     << o.min
-                     << " max "     << o.max;
+  for (const auto* it : options)
+  {
+      const Option& o = it->second;
+      os << "\noption name " << it->first << " type " << o.type;
 
-              break;
-          }
+      if (o.type == "string" || o.type == "check" || o.type == "combo")
+          os << " default " << o.defaultValue;
+
+      if (o.type == "spin")
+          os << " default " << int(stof(o.defaultValue))
+             << " min "     << o.min
+             << " max "     << o.max;
+  }
 
   return os;
 }
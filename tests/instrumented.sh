@@ -109,6 +109,28 @@ cat << EOF > game.exp
  exit \$value
 EOF
 
+# several games searched by a scheduler over a few workers
+cat << EOF > scheduler.exp
+ set timeout 240
+ spawn $exeprefix ./stockfish scheduler $threads 8
+
+ send "g1 position startpos\n"
+ send "g1 go nodes 1000\n"
+ send "g2 position startpos moves e2e4 e7e6\n"
+ send "g2 go nodes 1000\n"
+ send "g3 position fen 5rk1/1K4p1/8/8/3B4/8/8/8 b - - 0 1\n"
+ send "g3 go infinite\n"
+ send "g3 stop\n"
+ expect "g3 bestmove"
+
+ send "quit\n"
+ expect eof
+
+ # return error code of the spawned program, useful for valgrind
+ lassign [wait] pid spawnid os_error_flag value
+ exit \$value
+EOF
+
 #download TB as needed
 if [ ! -d ../tests/syzygy ]; then
    curl -sL https://api.github.com/repos/niklasf/python-chess/tarball/9b9aa13f9f36d08aadfabff872882f4ab1494e95 | tar -xzf -
@@ -130,7 +152,7 @@ cat << EOF > syzygy.exp
  exit \$value
 EOF
 
-for exp in game.exp syzygy.exp
+for exp in game.exp scheduler.exp syzygy.exp
 do
 
   echo "$prefix expect $exp $postfix"
@@ -0,0 +1,31 @@
+#!/bin/bash
+# verify that the batched NNUE evaluation matches the evaluation of single positions
+# an optional argument gives the network file to load
+
+error()
+{
+  echo "nnuebatch testing failed on line $1"
+  exit 1
+}
+trap 'error ${LINENO}' ERR
+
+echo "nnuebatch testing started"
+
+evalfile=""
+if [ $# -gt 0 ]; then
+   evalfile="setoption name EvalFile value $1"
+fi
+
+for fen in "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" \
+           "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10" \
+           "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11" \
+           "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1"
+do
+   batch=`printf "%s\nposition fen %s\nnnuebench 1\nquit\n" "$evalfile" "$fen" | ./stockfish 2>&1 | grep "Batch       : "`
+   if [ -z "$batch" ] || ! echo "$batch" | grep -q " 0 mismatches"; then
+      echo "batched evaluation mismatch for $fen: $batch"
+      exit 1
+   fi
+done
+
+echo "nnuebatch testing OK"
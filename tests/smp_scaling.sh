@@ -0,0 +1,40 @@
+#!/bin/bash
+# compare time-to-depth of the SMP modes for an increasing number of threads
+# usage: smp_scaling.sh [depth] [max threads] [hash]
+
+error()
+{
+  echo "smp scaling testing failed on line $1"
+  exit 1
+}
+trap 'error ${LINENO}' ERR
+
+depth=${1:-16}
+maxthreads=${2:-256}
+hash=${3:-1024}
+
+echo "smp scaling testing started (depth $depth, hash $hash)"
+
+printf "%8s %12s %12s %10s %10s\n" threads "Lazy (ms)" "ABDADA (ms)" "Lazy x" "ABDADA x"
+
+threads=1
+while [ $threads -le $maxthreads ]; do
+
+  for mode in Lazy ABDADA; do
+    time=`printf "setoption name SMP Mode value $mode\nbench $hash $threads $depth default depth\nquit\n" \
+          | ./stockfish 2>&1 | grep "Total time (ms) : " | awk '{print $5}'`
+    eval time_$mode=$time
+  done
+
+  # speedups are relative to single threaded Lazy SMP
+  if [ $threads -eq 1 ]; then
+    base_Lazy=$time_Lazy
+  fi
+
+  awk -v t=$threads -v b=$base_Lazy -v l=$time_Lazy -v a=$time_ABDADA \
+      'BEGIN { printf "%8d %12d %12d %10.2f %10.2f\n", t, l, a, b / l, b / a }'
+
+  threads=$((threads * 2))
+done
+
+echo "smp scaling testing OK"